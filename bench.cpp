@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#include "bench.h"
+#include "eventsim.h"
+#include "regions.h"
+#include "world.h"
+
+// Same as a window running at 60 fps
+const double BENCH_DT = 10.0 / 60;
+
+// A window sized box about as full as spawning allows, with the window's
+// collision precision for that many balls
+static double pairsPhase() {
+	World world(1500, 800);
+	world.spawnBalls(150, 10, 1);
+	for (int i = 0; i < 300; i++) {
+		world.step(BENCH_DT, 1000 / 150);
+	}
+	return world.kineticEnergy();
+}
+
+// Galton board: thousands of pegs and balls falling into bins through the region map
+static double scenePhase() {
+	World world(4000, 3000);
+	world.minRadius = 4;
+	world.maxRadius = 8;
+	for (int row = 0; row < 50; row++) {
+		for (int col = 0; col < 100; col++) {
+			world.obstacles.addPeg(Vector2(20 + (row % 2 ? 20 : 0) + col * 40, 2400 - row * 36), 4, 0.5);
+		}
+	}
+	for (int x = 80; x < 4000; x += 80) {
+		world.obstacles.addSegment(Vector2(x, 0), Vector2(x, 500), 0.3);
+	}
+	world.spawnBalls(5000, 10, 1);
+
+	RegionMap regions;
+	ViewRect view = { 0, 0, (double)world.width, (double)world.height };
+	for (int i = 0; i < 200; i++) {
+		regions.step(world, BENCH_DT, 1, view);
+	}
+	return world.kineticEnergy();
+}
+
+// Gravity-free hard-disk gas through the event-driven engine
+static double gasPhase() {
+	World world(1500, 800);
+	world.config.gravity = 0;
+	world.minRadius = 4;
+	world.maxRadius = 8;
+	world.spawnBalls(3000, 20, 1);
+
+	EventSim sim;
+	sim.reset(world.balls, world.width, world.height, world.config);
+	for (int i = 0; i < 600; i++) {
+		sim.advance(BENCH_DT);
+	}
+	return world.kineticEnergy();
+}
+
+int runBench(int argc, char** argv) {
+	int repeats = argc > 2 ? std::max(1, atoi(argv[2])) : 1;
+	struct Phase {
+		const char* name;
+		std::function<double()> run;
+	};
+	Phase phases[] = { { "pairs", pairsPhase }, { "scene", scenePhase }, { "gas", gasPhase } };
+
+	double total = 0;
+	for (Phase& p : phases) {
+		double best = 0, checksum = 0;
+		for (int r = 0; r < repeats; r++) {
+			auto start = std::chrono::steady_clock::now();
+			checksum = p.run();
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (r == 0 || seconds < best)
+				best = seconds;
+		}
+		// Checksums should match between builds; a difference means the optimizer changed the physics
+		printf("%-6s %8.3f s  energy %.6e\n", p.name, best, checksum);
+		fflush(stdout);
+		total += best;
+	}
+	printf("total  %8.3f s\n", total);
+	return 0;
+}
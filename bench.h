@@ -0,0 +1,15 @@
+#if !defined(BENCH_H)
+#define BENCH_H
+
+// Fixed, deterministic physics workload with no window, used both to train
+// the profile-guided build and to time it against the plain build. Each
+// phase stands in for one of the ways the window steps balls: the all-pairs
+// World::step, a large world full of pegs through RegionMap, and the
+// event-driven gas. Everything is seeded, so every build does the same work
+// and prints the same checksums.
+//
+// Entry point for: bounce.exe --bench [repeats]
+// Prints the best time of each phase over repeats and a "total" line.
+int runBench(int argc, char** argv);
+
+#endif // BENCH_H
@@ -5,10 +5,21 @@
 #include <time.h>
 #include <chrono>
 #include <iostream>
+#include <string>
+#include <cstdio>
 
 #include "helper.h"
 #include "drawing.h"
 #include "bouncyball.h"
+#include "world.h"
+#include "ensemble.h"
+#include "gravitation.h"
+#include "pacing.h"
+#include "camera.h"
+#include "regions.h"
+#include "stats.h"
+#include "eventsim.h"
+#include "bench.h"
 
 // Global Variables
 int START_BALLS = 100;
@@ -16,7 +27,8 @@ int COLLISION_PRECISION;
 
 const double SLING_POWER = 5;
 const double MAX_SPEED = 10;
-const double TIME_SCALE = 1000000000.0;
+// Longest real frame time simulated in one go, in seconds
+const double MAX_FRAME_TIME = 0.1;
 
 
 int screenX = 1500;
@@ -26,10 +38,39 @@ Vector2 mouse;
 Vector2 mouseDownPos;
 bool mouseDown = false;
 
-double resistance = 0;
-
+// The simulation, sized to the window
+World world(screenX, screenY);
 // List of balls
-std::vector<BouncyBall> balls = {};
+std::vector<BouncyBall>& balls = world.balls;
+double& resistance = world.config.resistance;
+bool paused = false;
+
+// Hard-disk gas: no gravity, and the event-driven engine while resistance is 0
+bool gasMode = false;
+EventSim eventSim;
+// Mutual gravitation between balls instead of uniform gravity
+bool nbodyMode = false;
+Gravitation gravitation;
+
+// View onto the world, which is the window unless --world or --scene fixes its size
+Camera camera;
+bool largeWorld = false;
+// Only simulates the parts of a large world near the camera
+RegionMap regions;
+// Right button drag pans the camera
+bool panning = false;
+int panX, panY;
+// Zoom per mouse wheel notch or +/- press
+const double ZOOM_STEP = 1.25;
+
+// Schedules frames instead of redrawing as fast as possible
+FramePacer pacer;
+
+// Optional live monitoring over a Unix domain socket
+StatsServer stats;
+bool statsEnabled = false;
+FrameStats frameStats;
+
 
 double randDouble(double start = 0, double end = 1) {
 	// Between 0 and 1
@@ -38,25 +79,6 @@ double randDouble(double start = 0, double end = 1) {
 	return r + start;
 }
 
-void checkCollisions(double dt) {
-	for (size_t i = 0; i < balls.size(); i++) {
-		for (size_t j = i + 1; j < balls.size(); j++) {
-			if (isColliding(balls[i], balls[j], dt)) {
-				handleCollision(balls[i], balls[j], dt);
-			}
-		}
-	}
-}
-
-bool anyCollisions(double dt, BouncyBall b) {
-	for (size_t i = 0; i < balls.size(); i++) {
-		if (isColliding(balls[i], b, dt)) {
-			return true;
-		}
-	}
-	return false;
-}
-
 BouncyBall createBall(Vector2 startPos, Vector2 startVel, double gravity = 9.8, std::string color = "") {
 	// Radius
 	int r = rand() % 30 + 10;
@@ -68,12 +90,64 @@ BouncyBall createBall(Vector2 startPos, Vector2 startVel, double gravity = 9.8,
 		c = { 0, 0, 1 };
 
 
-	startPos.x = clamp(startPos.x, r, screenX - r);
-	startPos.y = clamp(startPos.y, r, screenY - r);
+	startPos.x = clamp(startPos.x, r, world.width - r);
+	startPos.y = clamp(startPos.y, r, world.height - r);
 
 	return BouncyBall(startPos, startVel, r, c, gravity);
 }
 
+void keyboard(unsigned char c, int x, int y);
+
+// The gas engine only handles elastic flight between the four walls, so
+// resistance or a scene with obstacles falls back to normal stepping
+bool eventDriven() {
+	return !nbodyMode && gasMode && resistance == 0 && world.obstacles.empty();
+}
+
+// True if no ball is moving, so frames can't change anything
+bool worldAsleep() {
+	// The gas engine moves balls without update(), so their sleep counters go stale
+	bool exact = eventDriven();
+	for (size_t i = 0; i < balls.size(); i++) {
+		if (exact ? balls[i].vel.x != 0 || balls[i].vel.y != 0 : !balls[i].asleep())
+			return false;
+	}
+	return true;
+}
+
+void publishStats(double interval, int collisions) {
+	static auto start = std::chrono::steady_clock::now();
+	frameStats.record(pacer.workTime(), interval, collisions);
+
+	StatsSnapshot s = {};
+	frameStats.fill(s);
+	s.balls = balls.size();
+	s.ballBytes = balls.capacity() * sizeof(BouncyBall);
+	s.uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	s.resistance = resistance;
+	s.paused = paused;
+	s.collisionPasses = eventDriven() ? 1 : COLLISION_PRECISION;
+	s.renderEvery = pacer.renderEvery;
+	s.kineticEnergy = world.kineticEnergy();
+	Vector2 p = world.momentum();
+	s.momentumX = p.x;
+	s.momentumY = p.y;
+	stats.publish(s);
+}
+
+// Apply control commands sent to the stats socket
+void runStatsCommands() {
+	StatsCommand cmd;
+	while (stats.pollCommand(cmd)) {
+		if (cmd.type == StatsCommand::SET_RESISTANCE)
+			resistance = clamp(cmd.value, 0, 0.99);
+		else if (cmd.type == StatsCommand::SET_PAUSED)
+			paused = cmd.value != 0;
+		else
+			keyboard(cmd.key, 0, 0);
+	}
+}
+
 //
 // GLUT callback functions
 //
@@ -82,44 +156,108 @@ BouncyBall createBall(Vector2 startPos, Vector2 startVel, double gravity = 9.8,
 // system whenever it decides things need to be redrawn.
 void display(void) {
 	// Get frames/deltaTime
-	static auto start = std::chrono::system_clock::now();
-	static auto prev = start;
-	static int frame = 0;
-	auto now = std::chrono::system_clock::now();
-	frame++;
-
-	double dt = (now - prev).count() / TIME_SCALE;
-
-	// Current fps
-	double fps = 1 / dt;
-	std::cout << fps << std::endl;
-	// Current time
-	// std::cout << (now - start).count() / TIME_SCALE << std::endl;
-	prev = now;
-
-	dt *= 10;
-
-	glClear(GL_COLOR_BUFFER_BIT);
-
-	// In reality this is peformed with infinite precision, but we make do with what we have
-	for (int i = 0; i < COLLISION_PRECISION; i++) {
-		checkCollisions(dt);
+	static auto lastReport = std::chrono::steady_clock::now();
+	static int framesSinceReport = 0;
+	auto now = std::chrono::steady_clock::now();
+	framesSinceReport++;
+
+	double interval = pacer.beginFrame();
+
+	// Current fps, once a second rather than every frame
+	double sinceReport = std::chrono::duration<double>(now - lastReport).count();
+	if (sinceReport >= 1) {
+		std::cout << framesSinceReport / sinceReport << std::endl;
+		lastReport = now;
+		framesSinceReport = 0;
 	}
 
-
-	// Draw balls
-	for (auto ball = balls.begin(); ball != balls.end(); ++ball) {
-		ball->update(dt, screenX, screenY, resistance);
+	// Don't try to catch up after a stall or a slow idle tick all at once
+	double dt = std::min(interval, MAX_FRAME_TIME) * 10;
+
+	if (statsEnabled)
+		runStatsCommands();
+
+	int collisions = 0;
+	if (paused) {
+		// Nothing moves, just redraw
+	} else if (nbodyMode) {
+		collisions = gravitation.step(world, dt, COLLISION_PRECISION);
+		regions.invalidate();
+	} else if (eventDriven()) {
+		// Exact event-to-event stepping, so no collision precision loop needed
+		if (eventSim.stale(balls, world.width, world.height))
+			eventSim.reset(balls, world.width, world.height, world.config);
+		collisions = eventSim.advance(dt);
+		regions.invalidate();
+	} else if (largeWorld) {
+		collisions = regions.step(world, dt, COLLISION_PRECISION, camera.view(screenX, screenY));
+		eventSim.invalidate();
+	} else {
+		collisions = world.step(dt, COLLISION_PRECISION);
+		eventSim.invalidate();
 	}
+	pacer.simulated();
+
+	if (pacer.shouldRender()) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		camera.apply(screenX, screenY);
+		ViewRect view = camera.view(screenX, screenY);
+
+		// Draw balls, skipping any off screen. In a large world only the regions
+		// under the view are looked at. Balls under a pixel across are drawn as points.
+		static std::vector<int> candidates, tiny;
+		candidates.clear();
+		tiny.clear();
+		if (largeWorld) {
+			regions.ballsIn(world, view, candidates);
+		} else {
+			for (size_t i = 0; i < balls.size(); i++) {
+				candidates.push_back(i);
+			}
+		}
+		for (int i : candidates) {
+			BouncyBall& ball = balls[i];
+			if (!view.sees(ball.pos, ball.radius))
+				continue;
+			if (ball.radius * camera.zoom < 1)
+				tiny.push_back(i);
+			else
+				ball.draw();
+		}
+		if (!tiny.empty()) {
+			glBegin(GL_POINTS);
+			for (int i : tiny) {
+				glColor3dv((GLdouble*)&balls[i].color);
+				glVertex2dv((GLdouble*)&balls[i].pos);
+			}
+			glEnd();
+		}
+		if (largeWorld) {
+			// World edges
+			glColor3d(0, 0, 0);
+			DrawLine(Vector2(0, 0), Vector2(world.width, 0));
+			DrawLine(Vector2(world.width, 0), Vector2(world.width, world.height));
+			DrawLine(Vector2(world.width, world.height), Vector2(0, world.height));
+			DrawLine(Vector2(0, world.height), Vector2(0, 0));
+		}
+		world.obstacles.draw(view);
+		if (nbodyMode)
+			gravitation.drawAttractors();
+
+		// Draw slingshot launch vector
+		if (mouseDown) {
+			glColor3d(0, 0, 0);
+			DrawArrow(mouse, mouseDownPos);
+		}
 
-	// Draw slingshot launch vector
-	if (mouseDown) {
-		glColor3d(0, 0, 0);
-		DrawArrow(mouse, mouseDownPos);
+		glutSwapBuffers();
 	}
 
-	glutSwapBuffers();
-	glutPostRedisplay();
+	// Tick slowly while nothing can change without input
+	pacer.endFrame(!mouseDown && (paused || worldAsleep()));
+
+	if (statsEnabled)
+		publishStats(interval, collisions);
 }
 
 // This callback function gets called by the Glut
@@ -145,6 +283,27 @@ void keyboard(unsigned char c, int x, int y) {
 	case 'p': // Reset resistance to 0
 		resistance = 0;
 		break;
+	case 'f': // Freeze/unfreeze the simulation
+		paused = !paused;
+		break;
+	case '[': // Barnes-Hut opening angle, smaller is more accurate
+		gravitation.theta = std::max(0.0, gravitation.theta - 0.1);
+		std::cout << "theta " << gravitation.theta << std::endl;
+		break;
+	case ']':
+		gravitation.theta = std::min(2.0, gravitation.theta + 0.1);
+		std::cout << "theta " << gravitation.theta << std::endl;
+		break;
+	case 'c': // Remove attractors
+		gravitation.attractors.clear();
+		break;
+	case '+': // Zoom around the middle of the window
+	case '=':
+		camera.zoomAt(camera.center, ZOOM_STEP);
+		break;
+	case '-':
+		camera.zoomAt(camera.center, 1 / ZOOM_STEP);
+		break;
 	default:
 		// std::cout << (int)c << std::endl;
 		return; // if we don't care, return without glutPostRedisplay()
@@ -159,54 +318,93 @@ void reshape(int w, int h) {
 	// Reset our global variables to the new width and height.
 	screenX = w;
 	screenY = h;
+	// A large world keeps its size, otherwise the world is the window
+	if (!largeWorld) {
+		world.width = w;
+		world.height = h;
+		camera.center = Vector2(w / 2.0, h / 2.0);
+	}
 
 	// Set the pixel resolution of the final picture (Screen coordinates).
 	glViewport(0, 0, w, h);
 
 	// Set the projection mode to 2D orthographic, and set the world coordinates:
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluOrtho2D(0, w, 0, h);
-	glMatrixMode(GL_MODELVIEW);
+	camera.apply(w, h);
+}
+
+// Arrow keys pan the camera
+void specialKey(int key, int x, int y) {
+	double step = std::min(screenX, screenY) / 10.0;
+	switch (key) {
+	case GLUT_KEY_LEFT:
+		camera.pan(-step, 0);
+		break;
+	case GLUT_KEY_RIGHT:
+		camera.pan(step, 0);
+		break;
+	case GLUT_KEY_UP:
+		camera.pan(0, step);
+		break;
+	case GLUT_KEY_DOWN:
+		camera.pan(0, -step);
+		break;
+	default:
+		return;
+	}
+	glutPostRedisplay();
 }
 
 // This callback function gets called by the Glut
 // system whenever any mouse button goes up or down.
 void mouseClick(int mouse_button, int state, int x, int y) {
-	y = screenY - y;
+	Vector2 p = camera.toWorld(x, y, screenX, screenY);
 	if (mouse_button == GLUT_LEFT_BUTTON && state == GLUT_DOWN) {
-		mouseDownPos.x = (double)x;
-		mouseDownPos.y = (double)y;
+		mouseDownPos = p;
 		mouseDown = true;
 	}
 	if (mouse_button == GLUT_LEFT_BUTTON && state == GLUT_UP) {
 		Vector2 startVel = Vector2((mouseDownPos.x - mouse.x) / SLING_POWER, (mouseDownPos.y - mouse.y) / SLING_POWER);
-		balls.push_back(createBall(mouseDownPos, startVel));
+		balls.push_back(createBall(mouseDownPos, startVel, world.config.gravity));
 		mouseDown = false;
 	}
 	if (mouse_button == GLUT_MIDDLE_BUTTON && state == GLUT_DOWN) {
+		// Place an attractor
+		gravitation.addAttractor(p);
 	}
 	if (mouse_button == GLUT_MIDDLE_BUTTON && state == GLUT_UP) {
 	}
+	if (mouse_button == GLUT_RIGHT_BUTTON) {
+		panning = state == GLUT_DOWN;
+		panX = x;
+		panY = y;
+	}
+	// Mouse wheel, which freeglut reports as buttons 3 and 4
+	if ((mouse_button == 3 || mouse_button == 4) && state == GLUT_DOWN) {
+		camera.zoomAt(p, mouse_button == 3 ? ZOOM_STEP : 1 / ZOOM_STEP);
+	}
 	glutPostRedisplay();
 }
 
 void mouseMove(int x, int y) {
-	y = screenY - y;
-	mouse.x = (double)x;
-	mouse.y = (double)y;
+	if (panning) {
+		camera.pan(panX - x, y - panY);
+		panX = x;
+		panY = y;
+		glutPostRedisplay();
+	}
+	mouse = camera.toWorld(x, y, screenX, screenY);
 }
 
 void addBall(double gravity = 9.8, std::string color = "") {
 	// Starting position
-	Vector2 startPos = Vector2(rand() % (screenX), rand() % (screenY));
+	Vector2 startPos = Vector2(rand() % (world.width), rand() % (world.height));
 	// Starting speed
 	Vector2 startVel = Vector2(randDouble(-MAX_SPEED, MAX_SPEED), randDouble(-MAX_SPEED, MAX_SPEED));
 	BouncyBall b = createBall(startPos, startVel, gravity, color);
 	// Make sure the ball doesn't spawn inside another
-	while (anyCollisions(0, b)) {
-		startPos.x = rand() % (screenX);
-		startPos.y = rand() % (screenY);
+	while (world.anyCollisions(0, b)) {
+		startPos.x = rand() % (world.width);
+		startPos.y = rand() % (world.height);
 		startVel.x = randDouble(-MAX_SPEED, MAX_SPEED);
 		startVel.y = randDouble(-MAX_SPEED, MAX_SPEED);
 		b = createBall(startPos, startVel);
@@ -216,22 +414,9 @@ void addBall(double gravity = 9.8, std::string color = "") {
 
 // Create balls
 void initBalls(int num) {
-	for (int i = 0; i < num; i++) {
-		// Starting position
-		Vector2 startPos = Vector2(rand() % (screenX), rand() % (screenY));
-		// Starting speed
-		Vector2 startVel = Vector2(randDouble(-MAX_SPEED, MAX_SPEED), randDouble(-MAX_SPEED, MAX_SPEED));
-		BouncyBall b = createBall(startPos, startVel);
-		// Make sure the ball doesn't spawn inside another
-		while (anyCollisions(0, b)) {
-			startPos.x = rand() % (screenX);
-			startPos.y = rand() % (screenY);
-			startVel.x = randDouble(-MAX_SPEED, MAX_SPEED);
-			startVel.y = randDouble(-MAX_SPEED, MAX_SPEED);
-			b = createBall(startPos, startVel);
-		}
-		balls.push_back(b);
-	}
+	int placed = world.spawnBalls(num, MAX_SPEED, rand());
+	if (placed < num)
+		std::cout << "Only " << placed << " of " << num << " balls fit" << std::endl;
 }
 
 void initBallsTest1() {
@@ -250,11 +435,25 @@ void initBallsTest1() {
 void InitializeMyStuff(int numBalls) {
 	srand(time(NULL));
 
-	initBalls(numBalls);
+	if (nbodyMode)
+		gravitation.spawnCluster(world, numBalls, rand());
+	else
+		initBalls(numBalls);
 	// initBallsTest1();
 }
 
 int main(int argc, char** argv) {
+	// Headless parameter sweep, no window
+	if (argc > 1 && std::string(argv[1]) == "--sweep") {
+		return runSweep(argc, argv);
+	}
+	if (argc > 1 && std::string(argv[1]) == "--nbody-check") {
+		return runGravitationCheck(argc, argv);
+	}
+	if (argc > 1 && std::string(argv[1]) == "--bench") {
+		return runBench(argc, argv);
+	}
+
 	glutInit(&argc, argv);
 
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB);
@@ -268,10 +467,12 @@ int main(int argc, char** argv) {
 	} else {
 		glutCreateWindow("Bounce1");
 	}
+	pacer.enableVsync();
 
 	glutDisplayFunc(display);
 	glutKeyboardFunc(keyboard);
 	glutReshapeFunc(reshape);
+	glutSpecialFunc(specialKey);
 	glutMouseFunc(mouseClick);
 	glutMotionFunc(mouseMove);
 	glutPassiveMotionFunc(mouseMove);
@@ -280,9 +481,41 @@ int main(int argc, char** argv) {
 	glClearColor(0.8, 0.9, 0.8, 0); // background color
 
 	// Parse user args
-	if (argc > 1) {
-		START_BALLS = atoi(argv[1]);
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--stats" && i + 1 < argc) {
+			statsEnabled = stats.start(argv[++i]);
+		} else if (arg == "--nbody") {
+			nbodyMode = true;
+			world.config.gravity = 0;
+		} else if (arg == "--fps" && i + 1 < argc) {
+			pacer.targetFps = atof(argv[++i]);
+		} else if (arg == "--theta" && i + 1 < argc) {
+			gravitation.theta = atof(argv[++i]);
+		} else if (arg == "--world" && i + 1 < argc) {
+			// Fixed world size, e.g. --world 100000x50000
+			int w, h;
+			if (sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+				largeWorld = true;
+				world.width = w;
+				world.height = h;
+			}
+		} else if (arg == "--scene" && i + 1 < argc) {
+			// Obstacles, and maybe a world size, from a file. Scene coordinates
+			// are fixed, so the world no longer follows the window.
+			world.width = screenX;
+			world.height = screenY;
+			if (!loadScene(argv[++i], world))
+				return 1;
+			largeWorld = true;
+		} else if (arg == "--gas") {
+			gasMode = true;
+			world.config.gravity = 0;
+		} else {
+			START_BALLS = atoi(argv[i]);
+		}
 	}
+	camera.center = Vector2(screenX / 2.0, screenY / 2.0);
 	COLLISION_PRECISION = START_BALLS > 0 ? 1000 / START_BALLS : 1000;
 	if (COLLISION_PRECISION == 0) {
 		COLLISION_PRECISION = 1;
@@ -8,12 +8,15 @@
 #include "drawing.h"
 
 const double GROUNDED_THRESHOLD = 0;
-const double ELASTICITY = 0.9;
 const double COLLISION_THRESHOLD = 0.01;
 const int COLLISION_TIMEOUT = 1;
+// Below this speed for SLEEP_FRAMES updates in a row a ball is asleep
+const double SLEEP_SPEED = 0.2;
+const int SLEEP_FRAMES = 30;
 
 BouncyBall::BouncyBall(Vector2 startPos, Vector2 startVel, double radius, COLOR color, double gravity)
-	: pos(startPos), vel(startVel), radius(radius), color(color), rot(0), drot(0), justCollided(0), gravity(gravity) {}
+	: pos(startPos), vel(startVel), radius(radius), color(color), rot(0), drot(0), justCollided(0), gravity(gravity),
+	stillFrames(0) {}
 
 BouncyBall::~BouncyBall() {}
 
@@ -24,21 +27,39 @@ Vector2 BouncyBall::nextPos(double dt) {
 	return n;
 }
 
-void BouncyBall::bounce(double dt, int width, int height) {
+// Mass is proportional to area
+double BouncyBall::mass() {
+	return this->radius * this->radius;
+}
+
+void BouncyBall::bounce(double dt, int width, int height, double wallElasticity) {
 	Vector2 np = this->nextPos(dt);
 	if (np.x > width - this->radius + GROUNDED_THRESHOLD || np.x < this->radius) {
-		this->vel.x *= -0.67;
-		this->drot = this->vel.x / this->radius;
+		this->hitWall(true, wallElasticity);
 	}
 	if (np.y > height - this->radius + GROUNDED_THRESHOLD || np.y < this->radius) {
-		this->vel.y *= -0.67;
-		this->drot = this->vel.x / this->radius;
+		this->hitWall(false, wallElasticity);
 	}
 }
 
-void BouncyBall::update(double dt, int width, int height, double resistance) {
-	static Vector2 prevVel;
-	this->bounce(dt, width, height);
+void BouncyBall::hitWall(bool sideWall, double wallElasticity) {
+	if (sideWall)
+		this->vel.x *= -wallElasticity;
+	else
+		this->vel.y *= -wallElasticity;
+	this->drot = this->vel.x / this->radius;
+}
+
+void BouncyBall::update(double dt, int width, int height, const PhysicsConfig& config, const Vector2* move) {
+	// A bent path is only followed if it stays inside the walls, otherwise the
+	// walls reflect the ball as usual
+	if (move) {
+		Vector2 end = this->pos + *move;
+		if (end.x > width - this->radius || end.x < this->radius || end.y > height - this->radius || end.y < this->radius)
+			move = NULL;
+	}
+	if (!move)
+		this->bounce(dt, width, height, config.wallElasticity);
 
 	// std::cout << this->justCollided << std::endl;
 
@@ -51,15 +72,20 @@ void BouncyBall::update(double dt, int width, int height, double resistance) {
 	// So things can stop
 	// Make sure this is the last modification to velocity so it works
 	// If yVel is slow and we are either on the ground or not at apex
-	if ((abs(this->vel.y) < 1) && ((this->pos.y <= this->radius + GROUNDED_THRESHOLD) || (prevVel.y > 0)))
+	// Without gravity there is no ground or apex, so leave slow balls alone
+	if (this->gravity != 0 && (abs(this->vel.y) < 1) && ((this->pos.y <= this->radius + GROUNDED_THRESHOLD) || (this->prevVel.y > 0)))
 		this->vel.y = 0;
 	if (abs(this->vel.x) < 0.01)
 		this->vel.x = 0;
 
 
 	// Actually move
-	this->pos.x += this->vel.x * dt;
-	this->pos.y += this->vel.y * dt;
+	if (move) {
+		this->pos += *move;
+	} else {
+		this->pos.x += this->vel.x * dt;
+		this->pos.y += this->vel.y * dt;
+	}
 	this->rot -= this->drot * dt / 2;
 
 	// So balls don't retreat to the shadow dimension
@@ -67,19 +93,26 @@ void BouncyBall::update(double dt, int width, int height, double resistance) {
 
 	// Add friction if rolling on ground
 	if (this->pos.y <= this->radius + 5) {
-		this->vel.x *= 0.99;
+		this->vel.x *= config.groundFriction;
 		// Rolling speed
 		this->drot = this->vel.x / this->radius;
 	}
 
-	this->vel *= (1 - resistance);
-
-	prevVel = this->vel;
+	this->vel *= (1 - config.resistance);
 
-	this->draw();
+	this->prevVel = this->vel;
 
 	if (--this->justCollided < 0)
 		this->justCollided = 0;
+
+	if (this->vel.x * this->vel.x + this->vel.y * this->vel.y < SLEEP_SPEED * SLEEP_SPEED)
+		this->stillFrames++;
+	else
+		this->stillFrames = 0;
+}
+
+bool BouncyBall::asleep() {
+	return this->stillFrames >= SLEEP_FRAMES;
 }
 
 void BouncyBall::draw() {
@@ -95,7 +128,7 @@ bool isColliding(BouncyBall b1, BouncyBall b2, double dt) {
 	return false;
 }
 
-void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt) {
+void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt, double elasticity) {
 	b1.justCollided = COLLISION_TIMEOUT;
 	b2.justCollided = COLLISION_TIMEOUT;
 
@@ -162,8 +195,8 @@ void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt) {
 	}
 
 	// Set final speeds
-	b1.vel = Vector2(vf[0].x * ELASTICITY, vf[0].y * ELASTICITY);
-	b2.vel = Vector2(vf[1].x * ELASTICITY, vf[1].y * ELASTICITY);
+	b1.vel = Vector2(vf[0].x * elasticity, vf[0].y * elasticity);
+	b2.vel = Vector2(vf[1].x * elasticity, vf[1].y * elasticity);
 
 	// Rotation
 	b1.drot = b1.vel.x / b1.radius;
@@ -171,7 +204,7 @@ void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt) {
 }
 
 // Old
-void handleCollision2(BouncyBall& b1, BouncyBall& b2, double dt) {
+void handleCollision2(BouncyBall& b1, BouncyBall& b2, double dt, double elasticity) {
 	Vector2 en; // Center of Mass coordinate system, normal component
 	Vector2 et; // Center of Mass coordinate system, tangential component
 	Vector2 u[2]; // initial velocities of two particles
@@ -228,9 +261,9 @@ void handleCollision2(BouncyBall& b1, BouncyBall& b2, double dt) {
 	}
 
 	// reset particle values
-	b1.vel.x = (v[0].x * ELASTICITY);
-	b1.vel.y = (v[0].y * ELASTICITY);
-	b2.vel.x = (v[1].x * ELASTICITY);
-	b2.vel.y = (v[1].y * ELASTICITY);
+	b1.vel.x = (v[0].x * elasticity);
+	b1.vel.y = (v[0].y * elasticity);
+	b2.vel.x = (v[1].x * elasticity);
+	b2.vel.y = (v[1].y * elasticity);
 
 } /* Collide */
@@ -5,6 +5,20 @@
 #include "helper.h"
 #include "drawing.h"
 
+// Tunable physics constants. Each world gets its own copy so parameter sweeps
+// can run many worlds side by side.
+struct PhysicsConfig {
+	// Ball-ball restitution
+	double elasticity = 0.9;
+	// Restitution against the window edges
+	double wallElasticity = 0.67;
+	// Horizontal speed kept per step while rolling on the ground
+	double groundFriction = 0.99;
+	// Fraction of velocity lost per step
+	double resistance = 0;
+	// Gravity given to newly spawned balls
+	double gravity = 9.8;
+};
 
 // A ball that bounces
 class BouncyBall {
@@ -24,20 +38,30 @@ public:
 	int justCollided;
 
 	double gravity;
+	// Velocity after the last update
+	Vector2 prevVel;
+	// Consecutive updates spent slower than SLEEP_SPEED
+	int stillFrames;
 
 	BouncyBall(Vector2 startPos, Vector2 startVel, double radius, COLOR color, double gravity = 9.8);
 	~BouncyBall();
-	void update(double dt, int width, int height, double resistance);
+	// move, if given, is the displacement over dt along a path already bent by
+	// obstacles (see Obstacles::collide), used in place of vel * dt
+	void update(double dt, int width, int height, const PhysicsConfig& config, const Vector2* move = NULL);
 	void draw();
-	void bounce(double dt, int width, int height);
+	void bounce(double dt, int width, int height, double wallElasticity);
+	// Reflect off a left/right wall if sideWall, else off the floor/ceiling
+	void hitWall(bool sideWall, double wallElasticity);
 
 	// Next position given deltaTime
 	Vector2 nextPos(double dt);
 	double mass();
+	// Slow for long enough that the ball counts as settled
+	bool asleep();
 };
 
 bool isColliding(BouncyBall b1, BouncyBall b2, double dt);
-void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt);
-void handleCollision2(BouncyBall& b1, BouncyBall& b2, double dt);
+void handleCollision(BouncyBall& b1, BouncyBall& b2, double dt, double elasticity);
+void handleCollision2(BouncyBall& b1, BouncyBall& b2, double dt, double elasticity);
 
 #endif // BOUNCYBALL_H
@@ -0,0 +1,47 @@
+#include <GL/freeglut.h>
+
+#include "camera.h"
+#include "helper.h"
+
+const double MIN_ZOOM = 0.001;
+const double MAX_ZOOM = 20;
+
+bool ViewRect::sees(const Vector2& pos, double radius) const {
+	return pos.x + radius >= this->left && pos.x - radius <= this->right
+		&& pos.y + radius >= this->bottom && pos.y - radius <= this->top;
+}
+
+Camera::Camera()
+	: zoom(1) {}
+
+void Camera::apply(int width, int height) {
+	ViewRect v = this->view(width, height);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	gluOrtho2D(v.left, v.right, v.bottom, v.top);
+	glMatrixMode(GL_MODELVIEW);
+}
+
+ViewRect Camera::view(int width, int height) {
+	double halfW = width / 2.0 / this->zoom;
+	double halfH = height / 2.0 / this->zoom;
+	return { this->center.x - halfW, this->center.y - halfH, this->center.x + halfW, this->center.y + halfH };
+}
+
+Vector2 Camera::toWorld(int x, int y, int width, int height) {
+	return Vector2(this->center.x + (x - width / 2.0) / this->zoom,
+		this->center.y + (height / 2.0 - y) / this->zoom);
+}
+
+void Camera::pan(double dx, double dy) {
+	this->center.x += dx / this->zoom;
+	this->center.y += dy / this->zoom;
+}
+
+void Camera::zoomAt(Vector2 worldPoint, double factor) {
+	double z = clamp(this->zoom * factor, MIN_ZOOM, MAX_ZOOM);
+	// Scale the offset from the fixed point so it stays under the cursor
+	Vector2 offset = this->center - worldPoint;
+	this->center = worldPoint + offset * (this->zoom / z);
+	this->zoom = z;
+}
@@ -0,0 +1,35 @@
+#if !defined(CAMERA_H)
+#define CAMERA_H
+
+#include "vector2.h"
+
+// Visible part of the world
+struct ViewRect {
+	double left, bottom, right, top;
+
+	// True if a circle at pos overlaps the view
+	bool sees(const Vector2& pos, double radius) const;
+};
+
+// Pan/zoom view onto a world that can be larger than the window
+class Camera {
+public:
+	// World point at the middle of the window
+	Vector2 center;
+	// Window pixels per world unit
+	double zoom;
+
+	Camera();
+
+	// Set the projection for a window of width x height pixels
+	void apply(int width, int height);
+	ViewRect view(int width, int height);
+	// Window pixel coordinates (origin top left, as GLUT gives them) to world coordinates
+	Vector2 toWorld(int x, int y, int width, int height);
+	// Move by a distance in window pixels
+	void pan(double dx, double dy);
+	// Zoom by factor, keeping the world point under the cursor fixed
+	void zoomAt(Vector2 worldPoint, double factor);
+};
+
+#endif // CAMERA_H
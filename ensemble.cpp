@@ -0,0 +1,259 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <thread>
+
+#include "ensemble.h"
+#include "world.h"
+
+// Matches the spawn speed of the window
+const double SWEEP_MAX_SPEED = 10;
+
+static std::string trim(const std::string& s) {
+	size_t start = s.find_first_not_of(" \t\r");
+	if (start == std::string::npos)
+		return "";
+	size_t end = s.find_last_not_of(" \t\r");
+	return s.substr(start, end - start + 1);
+}
+
+// Parses "a, b, start:stop:step, ..." into a list of values
+static bool parseValues(const std::string& text, std::vector<double>& values) {
+	std::istringstream in(text);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		item = trim(item);
+		double start, stop, step;
+		char c1, c2;
+		std::istringstream range(item);
+		if (range >> start >> c1 >> stop >> c2 >> step && c1 == ':' && c2 == ':') {
+			if (step <= 0)
+				return false;
+			// Inclusive, with some slack for rounding
+			for (double v = start; v <= stop + step * 1e-6; v += step) {
+				values.push_back(v);
+			}
+			continue;
+		}
+		char* end;
+		double v = strtod(item.c_str(), &end);
+		if (item.empty() || *end != '\0')
+			return false;
+		values.push_back(v);
+	}
+	return !values.empty();
+}
+
+static bool setParam(SweepParams& p, const std::string& key, double v) {
+	if (key == "elasticity") p.config.elasticity = v;
+	else if (key == "wall_elasticity") p.config.wallElasticity = v;
+	else if (key == "friction") p.config.groundFriction = v;
+	else if (key == "resistance") p.config.resistance = v;
+	else if (key == "gravity") p.config.gravity = v;
+	else if (key == "balls") p.balls = (int)v;
+	else if (key == "steps") p.steps = (int)v;
+	else if (key == "precision") p.precision = (int)v;
+	else if (key == "width") p.width = (int)v;
+	else if (key == "height") p.height = (int)v;
+	else if (key == "dt") p.dt = v;
+	else if (key == "sample_every") p.sampleEvery = std::max(1, (int)v);
+	else if (key == "settle_fraction") p.settleFraction = v;
+	else if (key == "seed") p.seed = (unsigned)v;
+	else return false;
+	return true;
+}
+
+bool parseSweep(const std::string& path, std::vector<SweepParams>& worlds) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "sweep: can't open " << path << std::endl;
+		return false;
+	}
+
+	worlds = { SweepParams() };
+	std::string line;
+	int lineNo = 0;
+	while (std::getline(file, line)) {
+		lineNo++;
+		line = trim(line);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		size_t eq = line.find('=');
+		std::vector<double> values;
+		std::string key = trim(line.substr(0, eq));
+		SweepParams probe;
+		if (eq == std::string::npos || !setParam(probe, key, 0) || !parseValues(line.substr(eq + 1), values)) {
+			std::cerr << path << ":" << lineNo << ": bad sweep line: " << line << std::endl;
+			return false;
+		}
+
+		// Cartesian product with everything so far
+		std::vector<SweepParams> next;
+		for (const SweepParams& w : worlds) {
+			for (double v : values) {
+				next.push_back(w);
+				setParam(next.back(), key, v);
+			}
+		}
+		worlds.swap(next);
+	}
+	return true;
+}
+
+SweepResult runWorld(const SweepParams& p) {
+	auto start = std::chrono::steady_clock::now();
+	SweepResult r = { p, 0, -1, 0, {}, 0 };
+
+	World world(p.width, p.height, p.config);
+	r.spawned = world.spawnBalls(p.balls, SWEEP_MAX_SPEED, p.seed);
+	if (r.spawned < p.balls) {
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return r;
+	}
+
+	int precision = p.precision;
+	if (precision <= 0)
+		precision = std::max(1, p.balls > 0 ? 1000 / p.balls : 1000);
+
+	double peak = world.kineticEnergy();
+	// Last step at which the world was still moving
+	int lastActive = 0;
+	r.energy.push_back(peak);
+	for (int i = 1; i <= p.steps; i++) {
+		r.collisions += world.step(p.dt, precision);
+		double e = world.kineticEnergy();
+		peak = std::max(peak, e);
+		if (e >= p.settleFraction * peak)
+			lastActive = i;
+		if (i % p.sampleEvery == 0)
+			r.energy.push_back(e);
+	}
+	if (lastActive < p.steps)
+		r.settleTime = lastActive * p.dt;
+
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return r;
+}
+
+std::vector<SweepResult> runEnsemble(const std::vector<SweepParams>& worlds, int threads) {
+	std::vector<SweepResult> results(worlds.size());
+	std::atomic<size_t> next(0);
+
+	auto worker = [&]() {
+		for (size_t i = next++; i < worlds.size(); i = next++) {
+			results[i] = runWorld(worlds[i]);
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (int i = 0; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+	for (auto& t : pool) {
+		t.join();
+	}
+	return results;
+}
+
+void writeCsv(std::ostream& out, const std::vector<SweepResult>& results) {
+	out << "elasticity,wall_elasticity,friction,resistance,gravity,balls,spawned,steps,dt,seed,"
+		<< "settle_time,collisions,seconds,energy\n";
+	for (const SweepResult& r : results) {
+		const SweepParams& p = r.params;
+		out << p.config.elasticity << "," << p.config.wallElasticity << "," << p.config.groundFriction << ","
+			<< p.config.resistance << "," << p.config.gravity << "," << p.balls << "," << r.spawned << "," << p.steps << ","
+			<< p.dt << "," << p.seed << "," << r.settleTime << "," << r.collisions << "," << r.seconds << ",";
+		// Energy curve as one ; separated field
+		for (size_t i = 0; i < r.energy.size(); i++) {
+			out << (i ? ";" : "") << r.energy[i];
+		}
+		out << "\n";
+	}
+}
+
+void writeJson(std::ostream& out, const std::vector<SweepResult>& results) {
+	out << "[\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const SweepResult& r = results[i];
+		const SweepParams& p = r.params;
+		out << "  {\"elasticity\":" << p.config.elasticity
+			<< ",\"wall_elasticity\":" << p.config.wallElasticity
+			<< ",\"friction\":" << p.config.groundFriction
+			<< ",\"resistance\":" << p.config.resistance
+			<< ",\"gravity\":" << p.config.gravity
+			<< ",\"balls\":" << p.balls
+			<< ",\"spawned\":" << r.spawned
+			<< ",\"steps\":" << p.steps
+			<< ",\"dt\":" << p.dt
+			<< ",\"seed\":" << p.seed
+			<< ",\"settle_time\":";
+		if (r.settleTime < 0)
+			out << "null";
+		else
+			out << r.settleTime;
+		out << ",\"collisions\":" << r.collisions
+			<< ",\"seconds\":" << r.seconds
+			<< ",\"sample_every\":" << p.sampleEvery
+			<< ",\"energy\":[";
+		for (size_t j = 0; j < r.energy.size(); j++) {
+			out << (j ? "," : "") << r.energy[j];
+		}
+		out << "]}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "]\n";
+}
+
+int runSweep(int argc, char** argv) {
+	std::string spec, outPath;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--sweep" && i + 1 < argc) {
+			spec = argv[++i];
+		} else if (arg == "--out" && i + 1 < argc) {
+			outPath = argv[++i];
+		} else if (arg == "--threads" && i + 1 < argc) {
+			threads = std::max(1, atoi(argv[++i]));
+		} else {
+			std::cerr << "usage: " << argv[0] << " --sweep <spec> [--out results.csv|.json] [--threads n]" << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<SweepParams> worlds;
+	if (!parseSweep(spec, worlds))
+		return 1;
+
+	std::cerr << "Running " << worlds.size() << " worlds on " << threads << " threads" << std::endl;
+	auto start = std::chrono::steady_clock::now();
+	std::vector<SweepResult> results = runEnsemble(worlds, threads);
+	for (size_t i = 0; i < results.size(); i++) {
+		if (results[i].spawned < results[i].params.balls)
+			std::cerr << "sweep: world " << i << ": only " << results[i].spawned << " of "
+				<< results[i].params.balls << " balls fit, not run" << std::endl;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	bool json = outPath.size() >= 5 && outPath.compare(outPath.size() - 5, 5, ".json") == 0;
+	std::ofstream file;
+	if (!outPath.empty()) {
+		file.open(outPath);
+		if (!file) {
+			std::cerr << "sweep: can't write " << outPath << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = outPath.empty() ? std::cout : file;
+	if (json)
+		writeJson(out, results);
+	else
+		writeCsv(out, results);
+
+	std::cerr << "Done in " << seconds << " s, " << results.size() / seconds * 3600 << " worlds/hour" << std::endl;
+	return 0;
+}
@@ -0,0 +1,60 @@
+#if !defined(ENSEMBLE_H)
+#define ENSEMBLE_H
+
+#include <string>
+#include <vector>
+
+#include "bouncyball.h"
+
+// Settings for one headless world in a sweep
+struct SweepParams {
+	PhysicsConfig config;
+	int balls = 50;
+	int steps = 2000;
+	// Collision passes per step, 0 picks the same as the window does
+	int precision = 0;
+	int width = 1500;
+	int height = 800;
+	// Record kinetic energy every sampleEvery steps
+	int sampleEvery = 20;
+	// Window runs use 10x the real frame time, so this is one 60 Hz frame
+	double dt = 10.0 / 60;
+	// Settled once kinetic energy stays below this fraction of its peak
+	double settleFraction = 0.001;
+	unsigned seed = 1;
+};
+
+struct SweepResult {
+	SweepParams params;
+	// Balls actually placed. If fewer than params.balls fit, the world isn't run.
+	int spawned;
+	// Simulated time at which the world settled, -1 if it never did
+	double settleTime;
+	long collisions;
+	std::vector<double> energy;
+	// Wall clock time spent on this world
+	double seconds;
+};
+
+// Parses a sweep spec. Each line is "key = values" where values is a comma
+// separated list and/or start:stop:step ranges, e.g.
+//
+//   elasticity = 0.8, 0.9, 1.0
+//   wall_elasticity = 0.5:0.9:0.1
+//   seed = 1:4:1
+//
+// One world is run for every combination of values. Keys are elasticity,
+// wall_elasticity, friction, resistance, gravity, balls, steps, precision,
+// width, height, dt, sample_every, settle_fraction and seed. Lines starting
+// with # are comments. Returns false and prints the problem on error.
+bool parseSweep(const std::string& path, std::vector<SweepParams>& worlds);
+SweepResult runWorld(const SweepParams& p);
+// Runs every world on a pool of threads, results in spec order
+std::vector<SweepResult> runEnsemble(const std::vector<SweepParams>& worlds, int threads);
+void writeCsv(std::ostream& out, const std::vector<SweepResult>& results);
+void writeJson(std::ostream& out, const std::vector<SweepResult>& results);
+
+// Entry point for: bounce.exe --sweep <spec> [--out results.csv|.json] [--threads n]
+int runSweep(int argc, char** argv);
+
+#endif // ENSEMBLE_H
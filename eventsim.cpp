@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cmath>
+
+#include "eventsim.h"
+
+// Bail out of a frame after this many events so inelastic collapse can't hang the display
+const int MAX_EVENTS_PER_FRAME = 2000000;
+// Rebuild once the queue is mostly stale events
+const size_t QUEUE_SLACK = 32;
+
+EventSim::EventSim()
+	: balls(NULL), config(NULL), width(0), height(0), dirty(true), now(0), cellSize(1), cols(1), rows(1) {}
+
+bool EventSim::stale(const std::vector<BouncyBall>& balls, int width, int height) {
+	return this->dirty || this->balls != &balls || this->ballTime.size() != balls.size()
+		|| this->width != width || this->height != height;
+}
+
+void EventSim::invalidate() {
+	this->dirty = true;
+}
+
+void EventSim::reset(std::vector<BouncyBall>& balls, int width, int height, const PhysicsConfig& config) {
+	this->balls = &balls;
+	this->config = &config;
+	this->width = width;
+	this->height = height;
+	this->dirty = false;
+	this->now = 0;
+
+	size_t n = balls.size();
+	this->ballTime.assign(n, 0);
+	this->count.assign(n, 0);
+	this->cellX.assign(n, 0);
+	this->cellY.assign(n, 0);
+	this->events = decltype(this->events)();
+
+	// Cells at least one diameter wide, so touching balls are always in neighbouring cells
+	double maxRadius = 1;
+	for (size_t i = 0; i < n; i++) {
+		maxRadius = std::max(maxRadius, balls[i].radius);
+	}
+	this->cellSize = 2 * maxRadius;
+	this->cols = std::max(1, (int)ceil(width / this->cellSize));
+	this->rows = std::max(1, (int)ceil(height / this->cellSize));
+	this->cells.assign(this->cols * this->rows, std::vector<int>());
+
+	for (size_t i = 0; i < n; i++) {
+		BouncyBall& b = balls[i];
+		this->cellX[i] = (int)clamp(floor(b.pos.x / this->cellSize), 0, this->cols - 1);
+		this->cellY[i] = (int)clamp(floor(b.pos.y / this->cellSize), 0, this->rows - 1);
+		this->cell(this->cellX[i], this->cellY[i]).push_back(i);
+	}
+	for (size_t i = 0; i < n; i++) {
+		this->predictWalls(i);
+		this->predictCell(i);
+		// Each pair only once
+		int cx = this->cellX[i], cy = this->cellY[i];
+		for (int y = std::max(0, cy - 1); y <= std::min(this->rows - 1, cy + 1); y++) {
+			for (int x = std::max(0, cx - 1); x <= std::min(this->cols - 1, cx + 1); x++) {
+				for (int j : this->cell(x, y)) {
+					if (j > (int)i)
+						this->predictBall(i, j);
+				}
+			}
+		}
+	}
+}
+
+int EventSim::advance(double dt) {
+	std::vector<BouncyBall>& balls = *this->balls;
+	double target = this->now + dt;
+	int collisions = 0;
+	int processed = 0;
+
+	while (!this->events.empty() && this->events.top().time <= target) {
+		if (++processed > MAX_EVENTS_PER_FRAME) {
+			target = this->now;
+			break;
+		}
+		Event e = this->events.top();
+		this->events.pop();
+
+		if (e.countA != this->count[e.a] || (e.type == BALL && e.countB != this->count[e.b]))
+			continue;
+
+		this->now = e.time;
+		this->moveTo(e.a, this->now);
+
+		switch (e.type) {
+		case BALL:
+			this->moveTo(e.b, this->now);
+			handleCollision(balls[e.a], balls[e.b], 0, this->config->elasticity);
+			this->count[e.a]++;
+			this->count[e.b]++;
+			this->predict(e.a);
+			this->predict(e.b);
+			collisions++;
+			break;
+		case WALL_X:
+		case WALL_Y:
+			balls[e.a].hitWall(e.type == WALL_X, this->config->wallElasticity);
+			this->count[e.a]++;
+			this->predict(e.a);
+			break;
+		case CELL:
+			this->cross(e.a, e.b);
+			break;
+		}
+	}
+
+	// Frame time: bring every ball up to date so it can be drawn
+	this->now = target;
+	for (size_t i = 0; i < balls.size(); i++) {
+		this->moveTo(i, target);
+	}
+
+	if (this->events.size() > QUEUE_SLACK * balls.size() + 1024)
+		this->dirty = true;
+
+	return collisions;
+}
+
+Vector2 EventSim::posAt(int i, double t) {
+	BouncyBall& b = (*this->balls)[i];
+	return b.pos + b.vel * (t - this->ballTime[i]);
+}
+
+void EventSim::moveTo(int i, double t) {
+	BouncyBall& b = (*this->balls)[i];
+	double dt = t - this->ballTime[i];
+	b.pos += b.vel * dt;
+	b.rot -= b.drot * dt / 2;
+	this->ballTime[i] = t;
+}
+
+std::vector<int>& EventSim::cell(int x, int y) {
+	return this->cells[y * this->cols + x];
+}
+
+// New predictions after ball i changed velocity
+void EventSim::predict(int i) {
+	this->predictWalls(i);
+	this->predictCell(i);
+	int cx = this->cellX[i], cy = this->cellY[i];
+	this->predictCellRange(i, cx - 1, cx + 1, cy - 1, cy + 1);
+}
+
+void EventSim::predictWalls(int i) {
+	BouncyBall& b = (*this->balls)[i];
+	Vector2 p = this->posAt(i, this->now);
+	double t;
+
+	if (b.vel.x != 0) {
+		t = b.vel.x > 0 ? (this->width - b.radius - p.x) / b.vel.x : (b.radius - p.x) / b.vel.x;
+		this->events.push({ this->now + std::max(0.0, t), WALL_X, i, -1, this->count[i], 0 });
+	}
+	if (b.vel.y != 0) {
+		t = b.vel.y > 0 ? (this->height - b.radius - p.y) / b.vel.y : (b.radius - p.y) / b.vel.y;
+		this->events.push({ this->now + std::max(0.0, t), WALL_Y, i, -1, this->count[i], 0 });
+	}
+}
+
+// Only the earliest crossing matters; the next one is predicted when it happens.
+// Directions: 0 = +x, 1 = -x, 2 = +y, 3 = -y
+void EventSim::predictCell(int i) {
+	BouncyBall& b = (*this->balls)[i];
+	Vector2 p = this->posAt(i, this->now);
+	double best = INFINITY;
+	int dir = -1;
+
+	if (b.vel.x > 0 && this->cellX[i] < this->cols - 1) {
+		best = ((this->cellX[i] + 1) * this->cellSize - p.x) / b.vel.x;
+		dir = 0;
+	} else if (b.vel.x < 0 && this->cellX[i] > 0) {
+		best = (this->cellX[i] * this->cellSize - p.x) / b.vel.x;
+		dir = 1;
+	}
+	if (b.vel.y > 0 && this->cellY[i] < this->rows - 1) {
+		double t = ((this->cellY[i] + 1) * this->cellSize - p.y) / b.vel.y;
+		if (t < best) {
+			best = t;
+			dir = 2;
+		}
+	} else if (b.vel.y < 0 && this->cellY[i] > 0) {
+		double t = (this->cellY[i] * this->cellSize - p.y) / b.vel.y;
+		if (t < best) {
+			best = t;
+			dir = 3;
+		}
+	}
+
+	if (dir >= 0)
+		this->events.push({ this->now + std::max(0.0, best), CELL, i, dir, this->count[i], 0 });
+}
+
+// Standard hard-disk contact time: solve |dr + dv t| = r1 + r2 for the first root
+void EventSim::predictBall(int i, int j) {
+	if (i == j)
+		return;
+	BouncyBall& a = (*this->balls)[i];
+	BouncyBall& b = (*this->balls)[j];
+
+	Vector2 dr = this->posAt(j, this->now) - this->posAt(i, this->now);
+	Vector2 dv = b.vel - a.vel;
+	double dvdr = dr.x * dv.x + dr.y * dv.y;
+	// Moving apart
+	if (dvdr >= 0)
+		return;
+
+	double dvdv = dv.x * dv.x + dv.y * dv.y;
+	double drdr = dr.x * dr.x + dr.y * dr.y;
+	double sigma = a.radius + b.radius;
+	double d = dvdr * dvdr - dvdv * (drdr - sigma * sigma);
+	if (d < 0)
+		return;
+
+	// Overlapping and approaching means collide now
+	double t = drdr < sigma * sigma ? 0 : -(dvdr + sqrt(d)) / dvdv;
+	this->events.push({ this->now + t, BALL, i, j, this->count[i], this->count[j] });
+}
+
+void EventSim::predictCellRange(int i, int x0, int x1, int y0, int y1) {
+	for (int y = std::max(0, y0); y <= std::min(this->rows - 1, y1); y++) {
+		for (int x = std::max(0, x0); x <= std::min(this->cols - 1, x1); x++) {
+			for (int j : this->cell(x, y)) {
+				this->predictBall(i, j);
+			}
+		}
+	}
+}
+
+// Ball i moves into the next cell. Its velocity is unchanged so existing
+// predictions stay valid; only the row/column of cells it newly borders is checked.
+void EventSim::cross(int i, int dir) {
+	std::vector<int>& from = this->cell(this->cellX[i], this->cellY[i]);
+	from.erase(std::find(from.begin(), from.end(), i));
+
+	int cx = this->cellX[i] += (dir == 0) - (dir == 1);
+	int cy = this->cellY[i] += (dir == 2) - (dir == 3);
+	this->cell(cx, cy).push_back(i);
+
+	switch (dir) {
+	case 0: this->predictCellRange(i, cx + 1, cx + 1, cy - 1, cy + 1); break;
+	case 1: this->predictCellRange(i, cx - 1, cx - 1, cy - 1, cy + 1); break;
+	case 2: this->predictCellRange(i, cx - 1, cx + 1, cy + 1, cy + 1); break;
+	case 3: this->predictCellRange(i, cx - 1, cx + 1, cy - 1, cy - 1); break;
+	}
+	this->predictCell(i);
+}
@@ -0,0 +1,68 @@
+#if !defined(EVENTSIM_H)
+#define EVENTSIM_H
+
+#include <queue>
+#include <vector>
+
+#include "bouncyball.h"
+
+// Event-driven hard-disk engine for scenes with no gravity and no resistance.
+// Instead of stepping every pair each frame it predicts the exact time of each
+// ball's next wall hit, ball hit and grid cell crossing, and jumps straight from
+// one event to the next. Events are never removed from the queue; they are
+// invalidated lazily by comparing per-ball collision counts when popped.
+class EventSim {
+public:
+	EventSim();
+
+	// Rebuild the grid and every prediction for the given balls
+	void reset(std::vector<BouncyBall>& balls, int width, int height, const PhysicsConfig& config);
+	// True if the balls or bounds changed since the last reset
+	bool stale(const std::vector<BouncyBall>& balls, int width, int height);
+	// Force a reset on the next frame, e.g. after velocities were changed outside the engine
+	void invalidate();
+	// Process all events up to dt from now and move the balls there. Returns collisions handled.
+	int advance(double dt);
+
+private:
+	enum EventType { BALL, WALL_X, WALL_Y, CELL };
+
+	struct Event {
+		double time;
+		EventType type;
+		int a, b;
+		// Collision counts when predicted, for lazy invalidation
+		int countA, countB;
+
+		bool operator>(const Event& e) const { return time > e.time; }
+	};
+
+	std::vector<BouncyBall>* balls;
+	const PhysicsConfig* config;
+	int width, height;
+	bool dirty;
+	double now;
+
+	// Per ball: time its pos was last brought up to date, number of velocity changes, grid cell
+	std::vector<double> ballTime;
+	std::vector<int> count;
+	std::vector<int> cellX, cellY;
+
+	double cellSize;
+	int cols, rows;
+	std::vector<std::vector<int>> cells;
+
+	std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+	Vector2 posAt(int i, double t);
+	void moveTo(int i, double t);
+	std::vector<int>& cell(int x, int y);
+	void predict(int i);
+	void predictWalls(int i);
+	void predictCell(int i);
+	void predictBall(int i, int j);
+	void predictCellRange(int i, int x0, int x1, int y0, int y1);
+	void cross(int i, int dir);
+};
+
+#endif // EVENTSIM_H
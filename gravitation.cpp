@@ -0,0 +1,546 @@
+#include <GL/freeglut.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "gravitation.h"
+
+// Morton codes use 16 bits per axis, so the tree is at most this deep
+const int MAX_LEVEL = 16;
+const int LEAF_SIZE = 8;
+// Subtrees at this level are built in parallel
+const int SPLIT_LEVEL = 1;
+const double ATTRACTOR_MASS = 50000;
+
+// Spread the low 16 bits of v out to the even bits
+static unsigned part1by1(unsigned v) {
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Which child of a node at level holds code. Bit 0 is the x half, bit 1 the y half.
+static int quadrant(unsigned code, int level) {
+	return (code >> (2 * (MAX_LEVEL - 1 - level))) & 3;
+}
+
+Gravitation::Gravitation()
+	: G(20), theta(0.5), softening(5), rootX(0), rootY(0), rootHalf(1),
+	  jobChunks(0), jobNext(0), jobPending(0), jobGeneration(0), stopping(false) {
+	this->threads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+Gravitation::~Gravitation() {
+	{
+		std::lock_guard<std::mutex> guard(this->poolMutex);
+		this->stopping = true;
+	}
+	this->poolWake.notify_all();
+	for (auto& th : this->workers) {
+		th.join();
+	}
+}
+
+void Gravitation::workerLoop() {
+	std::unique_lock<std::mutex> lock(this->poolMutex);
+	unsigned seen = this->jobGeneration;
+	while (true) {
+		this->poolWake.wait(lock, [&]() { return this->stopping || this->jobGeneration != seen; });
+		if (this->stopping)
+			return;
+		seen = this->jobGeneration;
+		this->drainJob(lock);
+	}
+}
+
+void Gravitation::drainJob(std::unique_lock<std::mutex>& lock) {
+	while (this->jobNext < this->jobChunks) {
+		int k = this->jobNext++;
+		lock.unlock();
+		this->job(k);
+		lock.lock();
+		if (--this->jobPending == 0)
+			this->poolDone.notify_all();
+	}
+}
+
+void Gravitation::runJob(const std::function<void(int)>& f, int chunks) {
+	std::unique_lock<std::mutex> lock(this->poolMutex);
+	// A pass started from inside another one just runs on the calling thread
+	if (this->jobPending > 0) {
+		lock.unlock();
+		for (int k = 0; k < chunks; k++) {
+			f(k);
+		}
+		return;
+	}
+	while ((int)this->workers.size() < this->threads - 1) {
+		this->workers.emplace_back(&Gravitation::workerLoop, this);
+	}
+
+	this->job = f;
+	this->jobChunks = chunks;
+	this->jobNext = 0;
+	this->jobPending = chunks;
+	this->jobGeneration++;
+	this->poolWake.notify_all();
+
+	this->drainJob(lock);
+	this->poolDone.wait(lock, [&]() { return this->jobPending == 0; });
+	this->job = nullptr;
+}
+
+template <class F>
+void Gravitation::parallelFor(int n, int grain, F f) {
+	int t = std::min(this->threads, std::max(1, n / grain));
+	if (t <= 1) {
+		for (int i = 0; i < n; i++) {
+			f(i);
+		}
+		return;
+	}
+
+	int chunk = (n + t - 1) / t;
+	this->runJob([&](int k) {
+		for (int i = k * chunk; i < std::min(n, (k + 1) * chunk); i++) {
+			f(i);
+		}
+	}, t);
+}
+
+void Gravitation::buildTree(std::vector<BouncyBall>& balls) {
+	int n = balls.size();
+	this->nodes.clear();
+	if (n == 0)
+		return;
+
+	// Square bounds around every body
+	double minX = balls[0].pos.x, maxX = minX, minY = balls[0].pos.y, maxY = minY;
+	for (int i = 1; i < n; i++) {
+		minX = std::min(minX, balls[i].pos.x);
+		maxX = std::max(maxX, balls[i].pos.x);
+		minY = std::min(minY, balls[i].pos.y);
+		maxY = std::max(maxY, balls[i].pos.y);
+	}
+	this->rootX = (minX + maxX) / 2;
+	this->rootY = (minY + maxY) / 2;
+	this->rootHalf = std::max(std::max(maxX - minX, maxY - minY) / 2, 1.0) * 1.0001;
+
+	// Sort by Morton code, packed with the index so the sort moves plain integers
+	std::vector<uint64_t> keys(n);
+	double scale = 65536 / (2 * this->rootHalf);
+	double left = this->rootX - this->rootHalf, bottom = this->rootY - this->rootHalf;
+	this->parallelFor(n, 4096, [&](int i) {
+		unsigned qx = (unsigned)clamp((balls[i].pos.x - left) * scale, 0, 65535);
+		unsigned qy = (unsigned)clamp((balls[i].pos.y - bottom) * scale, 0, 65535);
+		keys[i] = ((uint64_t)(part1by1(qx) | (part1by1(qy) << 1)) << 32) | (unsigned)i;
+	});
+
+	// Sort chunks in parallel then merge them pairwise
+	int chunks = std::min(this->threads, std::max(1, n / 4096));
+	int chunk = (n + chunks - 1) / chunks;
+	this->parallelFor(chunks, 1, [&](int k) {
+		std::sort(keys.begin() + std::min(n, k * chunk), keys.begin() + std::min(n, (k + 1) * chunk));
+	});
+	for (int width = chunk; width < n; width *= 2) {
+		int pairs = (n + 2 * width - 1) / (2 * width);
+		this->parallelFor(pairs, 1, [&](int k) {
+			int lo = k * 2 * width, mid = std::min(n, lo + width), hi = std::min(n, lo + 2 * width);
+			std::inplace_merge(keys.begin() + lo, keys.begin() + mid, keys.begin() + hi);
+		});
+	}
+
+	this->order.resize(n);
+	this->codes.resize(n);
+	this->bodyX.resize(n);
+	this->bodyY.resize(n);
+	this->bodyMass.resize(n);
+	this->parallelFor(n, 4096, [&](int k) {
+		int i = (int)(keys[k] & 0xffffffff);
+		this->order[k] = i;
+		this->codes[k] = (unsigned)(keys[k] >> 32);
+		this->bodyX[k] = balls[i].pos.x;
+		this->bodyY[k] = balls[i].pos.y;
+		this->bodyMass[k] = balls[i].mass();
+	});
+
+	this->build(this->nodes, balls, 0, n, 0, this->rootX, this->rootY, this->rootHalf);
+}
+
+// Appends the subtree for bodies [first, first + count) to out and returns its root.
+// Children always come after their parent. At SPLIT_LEVEL the subtrees are built
+// on their own threads into separate arrays and then stitched on.
+int Gravitation::build(std::vector<Node>& out, std::vector<BouncyBall>& balls, int first, int count, int level,
+	double cx, double cy, double half) {
+	int idx = out.size();
+	Node n = { cx, cy, half, 0, Vector2(), 0, 0, first, count, { -1, -1, -1, -1 } };
+	out.push_back(n);
+
+	if (count <= LEAF_SIZE || level == MAX_LEVEL) {
+		this->finish(out[idx], out, balls);
+		return idx;
+	}
+
+	// Bodies are in Morton order, so each quadrant is a contiguous run
+	int start[5];
+	start[0] = first;
+	for (int q = 0; q < 4; q++) {
+		int i = start[q];
+		while (i < first + count && quadrant(this->codes[i], level) == q)
+			i++;
+		start[q + 1] = i;
+	}
+
+	if (level + 1 == SPLIT_LEVEL) {
+		std::vector<Node> sub[4];
+		this->parallelFor(4, 1, [&](int q) {
+			if (start[q + 1] > start[q])
+				this->build(sub[q], balls, start[q], start[q + 1] - start[q], level + 1,
+					cx + (q & 1 ? half : -half) / 2, cy + (q & 2 ? half : -half) / 2, half / 2);
+		});
+		for (int q = 0; q < 4; q++) {
+			if (sub[q].empty())
+				continue;
+			int offset = out.size();
+			for (Node& s : sub[q]) {
+				for (int c = 0; c < 4; c++) {
+					if (s.child[c] >= 0)
+						s.child[c] += offset;
+				}
+				out.push_back(s);
+			}
+			out[idx].child[q] = offset;
+		}
+	} else {
+		for (int q = 0; q < 4; q++) {
+			if (start[q + 1] > start[q]) {
+				int c = this->build(out, balls, start[q], start[q + 1] - start[q], level + 1,
+					cx + (q & 1 ? half : -half) / 2, cy + (q & 2 ? half : -half) / 2, half / 2);
+				out[idx].child[q] = c;
+			}
+		}
+	}
+
+	this->finish(out[idx], out, balls);
+	return idx;
+}
+
+// Mass, center of mass and contact bounds from the children, or the bodies of a leaf
+void Gravitation::finish(Node& n, std::vector<Node>& out, std::vector<BouncyBall>& balls) {
+	Vector2 weighted;
+	bool leaf = true;
+	for (int c = 0; c < 4; c++) {
+		if (n.child[c] < 0)
+			continue;
+		leaf = false;
+		Node& child = out[n.child[c]];
+		n.mass += child.mass;
+		weighted += child.com * child.mass;
+		n.maxRadius = std::max(n.maxRadius, child.maxRadius);
+	}
+	if (leaf) {
+		for (int k = n.first; k < n.first + n.count; k++) {
+			double m = this->bodyMass[k];
+			n.mass += m;
+			weighted += Vector2(this->bodyX[k], this->bodyY[k]) * m;
+			n.maxRadius = std::max(n.maxRadius, balls[this->order[k]].radius);
+		}
+	}
+	n.com = n.mass > 0 ? weighted / n.mass : Vector2(n.cx, n.cy);
+}
+
+// Acceleration of the body at Morton slot self
+Vector2 Gravitation::accelerationAt(int self) {
+	double px = this->bodyX[self], py = this->bodyY[self];
+	double eps2 = this->softening * this->softening;
+	double theta2 = this->theta * this->theta;
+	double ax = 0, ay = 0;
+
+	int stack[4 * MAX_LEVEL + 4];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& n = this->nodes[stack[--top]];
+		double dx = n.com.x - px;
+		double dy = n.com.y - py;
+		double d2 = dx * dx + dy * dy;
+		bool leaf = n.child[0] < 0 && n.child[1] < 0 && n.child[2] < 0 && n.child[3] < 0;
+		bool inside = fabs(px - n.cx) <= n.half && fabs(py - n.cy) <= n.half;
+
+		if (leaf) {
+			for (int k = n.first; k < n.first + n.count; k++) {
+				if (k == self)
+					continue;
+				double bx = this->bodyX[k] - px, by = this->bodyY[k] - py;
+				double r2 = bx * bx + by * by + eps2;
+				double f = this->G * this->bodyMass[k] / (r2 * sqrt(r2));
+				ax += bx * f;
+				ay += by * f;
+			}
+		} else if (!inside && 4 * n.half * n.half < theta2 * d2) {
+			// Far enough away to treat as a single body
+			double r2 = d2 + eps2;
+			double f = this->G * n.mass / (r2 * sqrt(r2));
+			ax += dx * f;
+			ay += dy * f;
+		} else {
+			for (int c = 0; c < 4; c++) {
+				if (n.child[c] >= 0)
+					stack[top++] = n.child[c];
+			}
+		}
+	}
+
+	for (const Attractor& a : this->attractors) {
+		double dx = a.pos.x - px, dy = a.pos.y - py;
+		double r2 = dx * dx + dy * dy + eps2;
+		double f = this->G * a.mass / (r2 * sqrt(r2));
+		ax += dx * f;
+		ay += dy * f;
+	}
+	return Vector2(ax, ay);
+}
+
+void Gravitation::barnesHut(std::vector<BouncyBall>& balls, std::vector<Vector2>& acc) {
+	acc.assign(balls.size(), Vector2());
+	if (this->nodes.empty())
+		return;
+	// Walk in Morton order so neighbouring queries touch the same nodes
+	this->parallelFor(balls.size(), 256, [&](int k) {
+		acc[this->order[k]] = this->accelerationAt(k);
+	});
+}
+
+Vector2 Gravitation::directAt(std::vector<BouncyBall>& balls, int self) {
+	Vector2 p = balls[self].pos;
+	double eps2 = this->softening * this->softening;
+	double ax = 0, ay = 0;
+	for (size_t j = 0; j < balls.size(); j++) {
+		if ((int)j == self)
+			continue;
+		BouncyBall& b = balls[j];
+		double dx = b.pos.x - p.x, dy = b.pos.y - p.y;
+		double r2 = dx * dx + dy * dy + eps2;
+		double f = this->G * b.mass() / (r2 * sqrt(r2));
+		ax += dx * f;
+		ay += dy * f;
+	}
+	for (const Attractor& a : this->attractors) {
+		double dx = a.pos.x - p.x, dy = a.pos.y - p.y;
+		double r2 = dx * dx + dy * dy + eps2;
+		double f = this->G * a.mass / (r2 * sqrt(r2));
+		ax += dx * f;
+		ay += dy * f;
+	}
+	return Vector2(ax, ay);
+}
+
+void Gravitation::directSum(std::vector<BouncyBall>& balls, std::vector<Vector2>& acc) {
+	acc.assign(balls.size(), Vector2());
+	this->parallelFor(balls.size(), 64, [&](int i) {
+		acc[i] = this->directAt(balls, i);
+	});
+}
+
+// Max speed per node for the contact query margins. Children come after their
+// parents, so walking backwards sees every child first.
+void Gravitation::refit(std::vector<BouncyBall>& balls) {
+	for (int i = (int)this->nodes.size() - 1; i >= 0; i--) {
+		Node& n = this->nodes[i];
+		n.maxSpeed = 0;
+		bool leaf = true;
+		for (int c = 0; c < 4; c++) {
+			if (n.child[c] >= 0) {
+				leaf = false;
+				n.maxSpeed = std::max(n.maxSpeed, this->nodes[n.child[c]].maxSpeed);
+			}
+		}
+		if (leaf) {
+			for (int k = n.first; k < n.first + n.count; k++) {
+				Vector2 v = balls[this->order[k]].vel;
+				n.maxSpeed = std::max(n.maxSpeed, v.mag());
+			}
+		}
+	}
+}
+
+// Finding candidate pairs is read only and runs in parallel; the pairs are then
+// resolved in a fixed order on one thread, rechecked with the velocities as they
+// are by then since earlier hits in the same pass may have changed them.
+int Gravitation::checkCollisions(World& world, double dt) {
+	std::vector<BouncyBall>& balls = world.balls;
+	if (this->nodes.empty())
+		return 0;
+	this->refit(balls);
+
+	int n = balls.size();
+	int chunks = std::min(n, this->threads * 4);
+	int chunk = (n + chunks - 1) / chunks;
+	std::vector<std::vector<std::pair<int, int>>> found(chunks);
+
+	this->parallelFor(chunks, 1, [&](int c) {
+		int stack[4 * MAX_LEVEL + 4];
+		// Morton order keeps consecutive queries in the same part of the tree
+		for (int slot = c * chunk; slot < std::min(n, (c + 1) * chunk); slot++) {
+			int i = this->order[slot];
+			BouncyBall& a = balls[i];
+			double reach = a.radius + a.vel.mag() * dt;
+
+			int top = 0;
+			stack[top++] = 0;
+			while (top > 0) {
+				const Node& node = this->nodes[stack[--top]];
+				// Distance from a to the node's square, against how far anything inside could reach
+				double dx = std::max(0.0, fabs(a.pos.x - node.cx) - node.half);
+				double dy = std::max(0.0, fabs(a.pos.y - node.cy) - node.half);
+				double r = reach + node.maxRadius + node.maxSpeed * dt;
+				if (dx * dx + dy * dy > r * r)
+					continue;
+
+				bool leaf = true;
+				for (int q = 0; q < 4; q++) {
+					if (node.child[q] >= 0) {
+						leaf = false;
+						stack[top++] = node.child[q];
+					}
+				}
+				if (leaf)
+					this->collectPairs(balls, i, node.first, node.count, dt, found[c]);
+			}
+		}
+	});
+
+	int hits = 0;
+	for (auto& pairs : found) {
+		for (auto& pair : pairs) {
+			if (isColliding(balls[pair.first], balls[pair.second], dt)) {
+				handleCollision(balls[pair.first], balls[pair.second], dt, world.config.elasticity);
+				hits++;
+			}
+		}
+	}
+	return hits;
+}
+
+// Pairs of ball i with the bodies in Morton slots [first, first + count) whose next positions overlap
+void Gravitation::collectPairs(std::vector<BouncyBall>& balls, int i, int first, int count, double dt,
+	std::vector<std::pair<int, int>>& out) {
+	BouncyBall& a = balls[i];
+	double ax = a.pos.x + a.vel.x * dt;
+	double ay = a.pos.y + a.vel.y * dt;
+	for (int k = first; k < first + count; k++) {
+		int j = this->order[k];
+		// Each pair once
+		if (j <= i)
+			continue;
+		// Same test as isColliding, without copying both balls
+		BouncyBall& b = balls[j];
+		double nx = b.pos.x + b.vel.x * dt - ax;
+		double ny = b.pos.y + b.vel.y * dt - ay;
+		double sum = a.radius + b.radius;
+		if (nx * nx + ny * ny <= sum * sum)
+			out.push_back(std::make_pair(i, j));
+	}
+}
+
+int Gravitation::step(World& world, double dt, int precision) {
+	std::vector<BouncyBall>& balls = world.balls;
+	std::vector<Vector2> acc;
+	this->buildTree(balls);
+	this->barnesHut(balls, acc);
+	for (size_t i = 0; i < balls.size(); i++) {
+		balls[i].vel += acc[i] * dt;
+	}
+
+	int hits = 0;
+	for (int i = 0; i < precision; i++) {
+		hits += this->checkCollisions(world, dt);
+	}
+	for (auto ball = balls.begin(); ball != balls.end(); ++ball) {
+		Vector2 move;
+		bool swept;
+		hits += world.obstacles.collide(*ball, dt, move, swept);
+		ball->update(dt, world.width, world.height, world.config, swept ? &move : NULL);
+	}
+	return hits;
+}
+
+void Gravitation::addAttractor(Vector2 pos) {
+	this->attractors.push_back({ pos, ATTRACTOR_MASS });
+}
+
+void Gravitation::drawAttractors() {
+	glColor3d(0, 0, 0);
+	for (Attractor& a : this->attractors) {
+		DrawLine(a.pos + Vector2(-8, -8), a.pos + Vector2(8, 8));
+		DrawLine(a.pos + Vector2(-8, 8), a.pos + Vector2(8, -8));
+	}
+}
+
+void Gravitation::spawnCluster(World& world, int num, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> unit(0, 1);
+
+	// Size balls so they cover about a fifth of the disk
+	double diskRadius = 0.45 * std::min(world.width, world.height);
+	double r = num > 0 ? clamp(diskRadius * sqrt(0.2 / num), 0.5, 20) : 1;
+	Vector2 center(world.width / 2.0, world.height / 2.0);
+	double totalMass = num * r * r;
+
+	for (int i = 0; i < num; i++) {
+		double d = diskRadius * sqrt(unit(rng));
+		double angle = 2 * M_PI * unit(rng);
+		Vector2 pos = center + Vector2(cos(angle), sin(angle)) * d;
+		// Slower than circular orbit speed for a uniform disk, so it slowly collapses
+		double speed = 0.7 * sqrt(this->G * totalMass * d) / diskRadius;
+		Vector2 vel = Vector2(-sin(angle), cos(angle)) * speed;
+		COLOR c = { unit(rng), unit(rng), unit(rng) };
+		world.balls.push_back(BouncyBall(pos, vel, r * (0.75 + 0.5 * unit(rng)), c, 0));
+	}
+}
+
+int runGravitationCheck(int argc, char** argv) {
+	int num = argc > 2 ? atoi(argv[2]) : 100000;
+	Gravitation g;
+	if (argc > 3)
+		g.theta = atof(argv[3]);
+
+	World world(1500, 800);
+	g.spawnCluster(world, num, 1);
+	std::vector<BouncyBall>& balls = world.balls;
+
+	auto start = std::chrono::steady_clock::now();
+	g.buildTree(balls);
+	auto built = std::chrono::steady_clock::now();
+	std::vector<Vector2> acc;
+	g.barnesHut(balls, acc);
+	auto done = std::chrono::steady_clock::now();
+
+	// Direct sum for a sample of bodies, it's O(n^2) for all of them
+	int samples = std::min(num, 2000);
+	double errSum = 0, errMax = 0;
+	auto directStart = std::chrono::steady_clock::now();
+	for (int s = 0; s < samples; s++) {
+		int i = (int)((long)s * num / samples);
+		Vector2 exact = g.directAt(balls, i);
+		Vector2 diff = acc[i] - exact;
+		double err = exact.mag() > 0 ? diff.mag() / exact.mag() : 0;
+		errSum += err;
+		errMax = std::max(errMax, err);
+	}
+	double directTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - directStart).count();
+
+	std::cout << "bodies: " << num << ", theta: " << g.theta << ", threads: " << std::thread::hardware_concurrency() << "\n"
+		<< "tree build: " << std::chrono::duration<double>(built - start).count() * 1000 << " ms\n"
+		<< "barnes-hut forces: " << std::chrono::duration<double>(done - built).count() * 1000 << " ms\n"
+		<< "direct sum (single thread, extrapolated): " << directTime / samples * num * 1000 << " ms\n"
+		<< "relative error over " << samples << " bodies: mean " << errSum / samples << ", max " << errMax << std::endl;
+	return 0;
+}
@@ -0,0 +1,110 @@
+#if !defined(GRAVITATION_H)
+#define GRAVITATION_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "bouncyball.h"
+#include "world.h"
+
+// A fixed point mass placed with the mouse
+struct Attractor {
+	Vector2 pos;
+	double mass;
+};
+
+// Mutual gravitation between balls, with mass derived from radius the same
+// way handleCollision does. Forces come from a Barnes-Hut quadtree built over
+// the balls sorted by Morton code; the same tree also replaces the O(n^2)
+// pair loop for contact detection. Tree build and force pass run on all cores.
+class Gravitation {
+public:
+	// Gravitational constant, tuned for screen units rather than SI
+	double G;
+	// Opening angle: a node is treated as one body when size / distance < theta
+	double theta;
+	// Plummer softening length, keeps close passes finite
+	double softening;
+	std::vector<Attractor> attractors;
+
+	Gravitation();
+	~Gravitation();
+
+	// Kick every ball by its gravitational acceleration, resolve contacts and
+	// move. Returns the number of colliding pairs handled.
+	int step(World& world, double dt, int precision);
+
+	// Accelerations from the quadtree built by buildTree
+	void barnesHut(std::vector<BouncyBall>& balls, std::vector<Vector2>& acc);
+	// O(n^2) reference for accuracy checks
+	void directSum(std::vector<BouncyBall>& balls, std::vector<Vector2>& acc);
+	void buildTree(std::vector<BouncyBall>& balls);
+	// Tree-accelerated equivalent of World::checkCollisions
+	int checkCollisions(World& world, double dt);
+
+	void addAttractor(Vector2 pos);
+	void drawAttractors();
+	// Spawn num small balls in a slowly rotating disk
+	void spawnCluster(World& world, int num, unsigned seed);
+	// Direct sum acceleration of a single ball
+	Vector2 directAt(std::vector<BouncyBall>& balls, int self);
+
+private:
+	struct Node {
+		// Square bounds
+		double cx, cy, half;
+		double mass;
+		Vector2 com;
+		// Largest radius and speed below this node, for contact queries
+		double maxRadius, maxSpeed;
+		// Range of bodies in Morton order
+		int first, count;
+		// -1 where there is no child; a leaf has none
+		int child[4];
+	};
+
+	std::vector<Node> nodes;
+	// Ball indices sorted by Morton code
+	std::vector<int> order;
+	std::vector<unsigned> codes;
+	// Position and mass in Morton order, for cache friendly leaf loops
+	std::vector<double> bodyX, bodyY, bodyMass;
+	double rootX, rootY, rootHalf;
+	int threads;
+
+	// Worker threads started on the first parallel pass and kept until destruction.
+	// Each job is split into chunks that the workers and the calling thread claim in turn.
+	std::vector<std::thread> workers;
+	std::mutex poolMutex;
+	std::condition_variable poolWake, poolDone;
+	std::function<void(int)> job;
+	int jobChunks, jobNext, jobPending;
+	unsigned jobGeneration;
+	bool stopping;
+
+	int build(std::vector<Node>& out, std::vector<BouncyBall>& balls, int first, int count, int level,
+		double cx, double cy, double half);
+	void finish(Node& n, std::vector<Node>& out, std::vector<BouncyBall>& balls);
+	Vector2 accelerationAt(int self);
+	void refit(std::vector<BouncyBall>& balls);
+	void collectPairs(std::vector<BouncyBall>& balls, int i, int first, int count, double dt,
+		std::vector<std::pair<int, int>>& out);
+	// Runs f(0..n-1) split over the worker threads, in chunks of at least grain
+	template <class F>
+	void parallelFor(int n, int grain, F f);
+	// Runs f(0..chunks-1) on the pool and returns once every chunk is done
+	void runJob(const std::function<void(int)>& f, int chunks);
+	void workerLoop();
+	// Claims and runs chunks of the current job until none are left. Called with lock held.
+	void drainJob(std::unique_lock<std::mutex>& lock);
+};
+
+// Headless Barnes-Hut vs direct sum timing and error report:
+// bounce.exe --nbody-check <bodies> [theta]
+int runGravitationCheck(int argc, char** argv);
+
+#endif // GRAVITATION_H
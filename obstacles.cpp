@@ -0,0 +1,479 @@
+#include <GL/freeglut.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "obstacles.h"
+#include "world.h"
+
+// Shapes per leaf of the hierarchy
+const int LEAF_SIZE = 4;
+// Restitution for shapes before any restitution line in a scene, same as the window walls
+const double DEFAULT_RESTITUTION = 0.67;
+// Sides used to draw a peg
+const int PEG_SIDES = 16;
+// Surfaces a ball can bounce off in one step, enough for a corner or a wedge
+const int MAX_BOUNCES = 4;
+
+Obstacles::Obstacles()
+	: dirty(false) {}
+
+void Obstacles::addSegment(Vector2 a, Vector2 b, double restitution) {
+	this->shapes.push_back({ SEGMENT, (int)this->points.size(), 2, 0, restitution });
+	this->points.push_back(a);
+	this->points.push_back(b);
+	this->dirty = true;
+}
+
+bool Obstacles::addPolygon(std::vector<Vector2> points, double restitution) {
+	if (points.size() < 3)
+		return false;
+
+	double area = 0;
+	for (size_t i = 0; i < points.size(); i++) {
+		Vector2& a = points[i];
+		Vector2& b = points[(i + 1) % points.size()];
+		area += a.x * b.y - b.x * a.y;
+	}
+	if (area == 0)
+		return false;
+	if (area < 0)
+		std::reverse(points.begin(), points.end());
+
+	// Every turn has to be to the left once counter-clockwise
+	for (size_t i = 0; i < points.size(); i++) {
+		Vector2 e1 = points[(i + 1) % points.size()] - points[i];
+		Vector2 e2 = points[(i + 2) % points.size()] - points[(i + 1) % points.size()];
+		if (e1.x * e2.y - e1.y * e2.x < 0)
+			return false;
+	}
+
+	this->shapes.push_back({ POLYGON, (int)this->points.size(), (int)points.size(), 0, restitution });
+	this->points.insert(this->points.end(), points.begin(), points.end());
+	this->dirty = true;
+	return true;
+}
+
+void Obstacles::addPeg(Vector2 center, double radius, double restitution) {
+	this->shapes.push_back({ PEG, (int)this->points.size(), 1, radius, restitution });
+	this->points.push_back(center);
+	this->dirty = true;
+}
+
+void Obstacles::clear() {
+	this->shapes.clear();
+	this->points.clear();
+	this->nodes.clear();
+	this->order.clear();
+	this->dirty = false;
+}
+
+bool Obstacles::empty() const {
+	return this->shapes.empty();
+}
+
+size_t Obstacles::size() const {
+	return this->shapes.size();
+}
+
+void Obstacles::build() {
+	size_t n = this->shapes.size();
+	this->boxes.assign(4 * n, 0);
+	for (size_t i = 0; i < n; i++) {
+		Shape& s = this->shapes[i];
+		double* box = &this->boxes[4 * i];
+		box[0] = box[1] = INFINITY;
+		box[2] = box[3] = -INFINITY;
+		for (int k = s.first; k < s.first + s.count; k++) {
+			Vector2& p = this->points[k];
+			box[0] = std::min(box[0], p.x - s.radius);
+			box[1] = std::min(box[1], p.y - s.radius);
+			box[2] = std::max(box[2], p.x + s.radius);
+			box[3] = std::max(box[3], p.y + s.radius);
+		}
+	}
+
+	this->order.resize(n);
+	for (size_t i = 0; i < n; i++) {
+		this->order[i] = i;
+	}
+	this->nodes.clear();
+	if (n > 0)
+		this->buildNode(0, n);
+	this->boxes.clear();
+	this->dirty = false;
+}
+
+// Median split along the longer side, so the tree stays balanced however the shapes are laid out
+int Obstacles::buildNode(int first, int count) {
+	int index = this->nodes.size();
+	Node node = { INFINITY, INFINITY, -INFINITY, -INFINITY, first, count };
+	for (int k = first; k < first + count; k++) {
+		double* box = &this->boxes[4 * this->order[k]];
+		node.minX = std::min(node.minX, box[0]);
+		node.minY = std::min(node.minY, box[1]);
+		node.maxX = std::max(node.maxX, box[2]);
+		node.maxY = std::max(node.maxY, box[3]);
+	}
+	this->nodes.push_back(node);
+	if (count <= LEAF_SIZE)
+		return index;
+
+	int axis = node.maxX - node.minX >= node.maxY - node.minY ? 0 : 1;
+	int half = count / 2;
+	std::nth_element(this->order.begin() + first, this->order.begin() + first + half, this->order.begin() + first + count,
+		[&](int a, int b) {
+			double* ba = &this->boxes[4 * a];
+			double* bb = &this->boxes[4 * b];
+			return ba[axis] + ba[axis + 2] < bb[axis] + bb[axis + 2];
+		});
+
+	this->buildNode(first, half);
+	int right = this->buildNode(first + half, count - half);
+	this->nodes[index].first = right;
+	this->nodes[index].count = 0;
+	return index;
+}
+
+template <class F>
+void Obstacles::query(double minX, double minY, double maxX, double maxY, F f) {
+	if (this->dirty)
+		this->build();
+	if (this->nodes.empty())
+		return;
+
+	// Balanced, so depth is about log2(shapes / LEAF_SIZE)
+	int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const Node& n = this->nodes[index];
+		if (n.minX > maxX || n.maxX < minX || n.minY > maxY || n.maxY < minY)
+			continue;
+		if (n.count > 0) {
+			for (int k = n.first; k < n.first + n.count; k++) {
+				f(this->order[k]);
+			}
+		} else {
+			stack[top++] = index + 1;
+			stack[top++] = n.first;
+		}
+	}
+}
+
+// Closest point on segment ab to p
+static Vector2 closestOnSegment(Vector2 a, Vector2 b, Vector2 p) {
+	Vector2 ab = b - a;
+	double len2 = ab.x * ab.x + ab.y * ab.y;
+	double t = len2 > 0 ? clamp(((p.x - a.x) * ab.x + (p.y - a.y) * ab.y) / len2, 0, 1) : 0;
+	return a + ab * t;
+}
+
+double Obstacles::distance(const Shape& s, Vector2 p, Vector2& normal) {
+	switch (s.kind) {
+	case SEGMENT: {
+		Vector2& a = this->points[s.first];
+		Vector2& b = this->points[s.first + 1];
+		Vector2 diff = p - closestOnSegment(a, b, p);
+		double d = diff.mag();
+		// Dead on the line: either side will do
+		normal = d > 0 ? diff / d : Vector2(a.y - b.y, b.x - a.x).normalized();
+		return d;
+	}
+	case PEG: {
+		Vector2 diff = p - this->points[s.first];
+		double d = diff.mag();
+		normal = d > 0 ? diff / d : Vector2(0, 1);
+		return d - s.radius;
+	}
+	case POLYGON: {
+		// Outside: distance to the nearest edge. Inside: depth below the shallowest edge.
+		bool inside = true;
+		double nearest = INFINITY, shallowest = -INFINITY;
+		Vector2 nearestNormal, shallowestNormal;
+		for (int k = 0; k < s.count; k++) {
+			Vector2& a = this->points[s.first + k];
+			Vector2& b = this->points[s.first + (k + 1) % s.count];
+			Vector2 out = Vector2(b.y - a.y, a.x - b.x).normalized();
+			double side = (p.x - a.x) * out.x + (p.y - a.y) * out.y;
+			if (side > 0)
+				inside = false;
+			if (side > shallowest) {
+				shallowest = side;
+				shallowestNormal = out;
+			}
+
+			Vector2 diff = p - closestOnSegment(a, b, p);
+			double d = diff.mag();
+			if (d < nearest) {
+				nearest = d;
+				nearestNormal = d > 0 ? diff / d : out;
+			}
+		}
+		normal = inside ? shallowestNormal : nearestNormal;
+		return inside ? shallowest : nearest;
+	}
+	}
+	return INFINITY;
+}
+
+// First time in [0, 1] at which p + d t comes within R of c, or INFINITY.
+// Starting inside doesn't count, that's left to the overlap push out.
+static double circleImpact(Vector2 p, Vector2 d, Vector2 c, double R, Vector2& normal) {
+	Vector2 f = p - c;
+	double a = d.x * d.x + d.y * d.y;
+	double half = f.x * d.x + f.y * d.y;
+	double start = f.x * f.x + f.y * f.y - R * R;
+	// Not moving, moving away, or already inside
+	if (a == 0 || half >= 0 || start < 0)
+		return INFINITY;
+	double disc = half * half - a * start;
+	if (disc < 0)
+		return INFINITY;
+	double t = (-half - sqrt(disc)) / a;
+	if (t > 1)
+		return INFINITY;
+	normal = (f + d * t) / R;
+	return t;
+}
+
+// First time in [0, 1] at which p + d t reaches the line through ab pushed out
+// by r along the unit normal out, within the length of ab
+static double edgeImpact(Vector2 p, Vector2 d, Vector2 a, Vector2 b, Vector2 out, double r, Vector2& normal) {
+	double gap = (p.x - a.x) * out.x + (p.y - a.y) * out.y - r;
+	double closing = d.x * out.x + d.y * out.y;
+	if (closing >= 0 || gap < 0)
+		return INFINITY;
+	double t = gap / -closing;
+	if (t > 1)
+		return INFINITY;
+	Vector2 ab = b - a;
+	Vector2 q = p + d * t;
+	double along = (q.x - a.x) * ab.x + (q.y - a.y) * ab.y;
+	if (along < 0 || along > ab.x * ab.x + ab.y * ab.y)
+		return INFINITY;
+	normal = out;
+	return t;
+}
+
+// Sweeps a ball of radius r from p to p + d against the shape grown by r: a
+// circle for a peg, a capsule for a segment, and offset edges with rounded
+// corners for a polygon. Returns the fraction of d travelled before touching.
+double Obstacles::impact(const Shape& s, Vector2 p, Vector2 d, double r, Vector2& normal) {
+	double first = INFINITY;
+	Vector2 n;
+	auto keep = [&](double t) {
+		if (t < first) {
+			first = t;
+			normal = n;
+		}
+	};
+
+	switch (s.kind) {
+	case PEG:
+		keep(circleImpact(p, d, this->points[s.first], s.radius + r, n));
+		break;
+	case SEGMENT: {
+		Vector2& a = this->points[s.first];
+		Vector2& b = this->points[s.first + 1];
+		Vector2 out = Vector2(b.y - a.y, a.x - b.x).normalized();
+		keep(edgeImpact(p, d, a, b, out, r, n));
+		keep(edgeImpact(p, d, a, b, out * -1, r, n));
+		keep(circleImpact(p, d, a, r, n));
+		keep(circleImpact(p, d, b, r, n));
+		break;
+	}
+	case POLYGON:
+		for (int k = 0; k < s.count; k++) {
+			Vector2& a = this->points[s.first + k];
+			Vector2& b = this->points[s.first + (k + 1) % s.count];
+			keep(edgeImpact(p, d, a, b, Vector2(b.y - a.y, a.x - b.x).normalized(), r, n));
+			keep(circleImpact(p, d, a, r, n));
+		}
+		break;
+	}
+	return first;
+}
+
+// Only the normal part of the velocity bounces, the rest slides along the surface
+static bool reflect(BouncyBall& b, Vector2 n, double restitution) {
+	double vn = b.vel.x * n.x + b.vel.y * n.y;
+	if (vn >= 0)
+		return false;
+	b.vel -= n * ((1 + restitution) * vn);
+	b.drot = (b.vel.x * n.y - b.vel.y * n.x) / b.radius;
+	return true;
+}
+
+int Obstacles::collide(BouncyBall& b, double dt, Vector2& move, bool& swept) {
+	int hits = 0;
+	swept = false;
+	if (this->shapes.empty())
+		return 0;
+
+	// Push out of anything already overlapping so balls can't sink in
+	this->query(b.pos.x - b.radius, b.pos.y - b.radius, b.pos.x + b.radius, b.pos.y + b.radius, [&](int i) {
+		Shape& s = this->shapes[i];
+		Vector2 n;
+		double d = this->distance(s, b.pos, n);
+		if (d < b.radius) {
+			b.pos += n * (b.radius - d);
+			hits += reflect(b, n, s.restitution);
+		}
+	});
+
+	// Follow the path over dt, bouncing off the first surface it reaches each
+	// time, so fast balls can't skip through thin geometry between steps
+	Vector2 p = b.pos;
+	double left = dt;
+	for (int k = 0; k < MAX_BOUNCES && left > 0; k++) {
+		Vector2 d = b.vel * left;
+		Vector2 end = p + d;
+		double first = INFINITY;
+		Vector2 normal;
+		int shape = -1;
+		this->query(std::min(p.x, end.x) - b.radius, std::min(p.y, end.y) - b.radius,
+			std::max(p.x, end.x) + b.radius, std::max(p.y, end.y) + b.radius, [&](int i) {
+				Vector2 n;
+				double t = this->impact(this->shapes[i], p, d, b.radius, n);
+				if (t < first) {
+					first = t;
+					normal = n;
+					shape = i;
+				}
+			});
+		if (shape < 0)
+			break;
+
+		p += d * first;
+		left -= left * first;
+		if (reflect(b, normal, this->shapes[shape].restitution)) {
+			hits++;
+			swept = true;
+		}
+	}
+
+	if (swept)
+		move = p + b.vel * left - b.pos;
+	return hits;
+}
+
+bool Obstacles::overlaps(BouncyBall& b) {
+	bool hit = false;
+	this->query(b.pos.x - b.radius, b.pos.y - b.radius, b.pos.x + b.radius, b.pos.y + b.radius, [&](int i) {
+		Vector2 n;
+		if (!hit && this->distance(this->shapes[i], b.pos, n) < b.radius)
+			hit = true;
+	});
+	return hit;
+}
+
+void Obstacles::draw(const ViewRect& view) {
+	glColor3d(0.3, 0.3, 0.3);
+	this->query(view.left, view.bottom, view.right, view.top, [&](int i) {
+		Shape& s = this->shapes[i];
+		switch (s.kind) {
+		case SEGMENT:
+			DrawLine(this->points[s.first], this->points[s.first + 1]);
+			break;
+		case POLYGON:
+			glBegin(GL_POLYGON);
+			for (int k = s.first; k < s.first + s.count; k++) {
+				glVertex2dv((GLdouble*)&this->points[k]);
+			}
+			glEnd();
+			break;
+		case PEG: {
+			Vector2& c = this->points[s.first];
+			glBegin(GL_POLYGON);
+			for (int k = 0; k < PEG_SIDES; k++) {
+				double theta = k * M_PI * 2 / PEG_SIDES;
+				glVertex2d(c.x + s.radius * cos(theta), c.y + s.radius * sin(theta));
+			}
+			glEnd();
+			break;
+		}
+		}
+	});
+}
+
+bool loadScene(const std::string& path, World& world) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "scene: can't open " << path << std::endl;
+		return false;
+	}
+
+	world.obstacles.clear();
+	double restitution = DEFAULT_RESTITUTION;
+	std::string line;
+	int lineNo = 0;
+	while (std::getline(file, line)) {
+		lineNo++;
+		std::istringstream in(line);
+		std::string key;
+		if (!(in >> key) || key[0] == '#')
+			continue;
+
+		bool ok = false;
+		if (key == "size") {
+			int w, h;
+			ok = in >> w >> h && w > 0 && h > 0;
+			if (ok) {
+				world.width = w;
+				world.height = h;
+			}
+		} else if (key == "radius") {
+			int lo, hi;
+			ok = in >> lo >> hi && lo > 0 && hi >= lo;
+			if (ok) {
+				world.minRadius = lo;
+				world.maxRadius = hi;
+			}
+		} else if (key == "restitution") {
+			ok = (in >> restitution) && restitution >= 0;
+		} else if (key == "segment") {
+			double x1, y1, x2, y2;
+			ok = (bool)(in >> x1 >> y1 >> x2 >> y2);
+			if (ok)
+				world.obstacles.addSegment(Vector2(x1, y1), Vector2(x2, y2), restitution);
+		} else if (key == "polygon") {
+			std::vector<double> coords;
+			double v;
+			while (in >> v) {
+				coords.push_back(v);
+			}
+			std::vector<Vector2> points;
+			for (size_t k = 0; k + 1 < coords.size(); k += 2) {
+				points.push_back(Vector2(coords[k], coords[k + 1]));
+			}
+			ok = in.eof() && coords.size() % 2 == 0 && world.obstacles.addPolygon(points, restitution);
+		} else if (key == "peg") {
+			double x, y, r;
+			ok = in >> x >> y >> r && r > 0;
+			if (ok)
+				world.obstacles.addPeg(Vector2(x, y), r, restitution);
+		} else if (key == "pegs") {
+			// Galton board grid, every other row shifted by half a column
+			double x, y, dx, dy, r;
+			int cols, rows;
+			ok = in >> x >> y >> cols >> rows >> dx >> dy >> r && cols > 0 && rows > 0 && r > 0;
+			for (int row = 0; ok && row < rows; row++) {
+				double shift = row % 2 ? dx / 2 : 0;
+				for (int col = 0; col < cols; col++) {
+					world.obstacles.addPeg(Vector2(x + shift + col * dx, y - row * dy), r, restitution);
+				}
+			}
+		}
+
+		if (!ok) {
+			std::cerr << path << ":" << lineNo << ": bad scene line: " << line << std::endl;
+			return false;
+		}
+	}
+	world.obstacles.build();
+	return true;
+}
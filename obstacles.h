@@ -0,0 +1,95 @@
+#if !defined(OBSTACLES_H)
+#define OBSTACLES_H
+
+#include <string>
+#include <vector>
+
+#include "bouncyball.h"
+#include "camera.h"
+
+class World;
+
+// Fixed geometry the balls bounce off: line segments, convex polygons and
+// round pegs. Shapes are kept in a bounding volume hierarchy so each ball only
+// tests the few shapes its path overlaps, whatever the total count.
+class Obstacles {
+public:
+	Obstacles();
+
+	// restitution is the fraction of normal speed kept after a bounce
+	void addSegment(Vector2 a, Vector2 b, double restitution);
+	// Convex, in either winding. Returns false if the points aren't convex.
+	bool addPolygon(std::vector<Vector2> points, double restitution);
+	void addPeg(Vector2 center, double radius, double restitution);
+	void clear();
+	bool empty() const;
+	size_t size() const;
+
+	// Rebuild the hierarchy. Called automatically before the first query after shapes change.
+	void build();
+
+	// Push ball out of anything it overlaps now, then sweep it along its path
+	// over dt and bounce it off every surface it reaches on the way. If the
+	// path bent, swept is set and move holds the displacement along it, for
+	// BouncyBall::update to apply. Returns the number of bounces.
+	int collide(BouncyBall& b, double dt, Vector2& move, bool& swept);
+	// True if a ball at b.pos would overlap any shape
+	bool overlaps(BouncyBall& b);
+
+	// Draw the shapes that overlap view
+	void draw(const ViewRect& view);
+
+private:
+	enum Kind { SEGMENT, POLYGON, PEG };
+
+	struct Shape {
+		Kind kind;
+		// Range in points: 2 for a segment, the counter-clockwise outline for a
+		// polygon, 1 (the center) for a peg
+		int first, count;
+		double radius;
+		double restitution;
+	};
+
+	// Flattened tree. The left child follows its parent directly; leaves have count > 0.
+	struct Node {
+		double minX, minY, maxX, maxY;
+		// Leaf: range in order. Inner: index of the right child.
+		int first, count;
+	};
+
+	std::vector<Shape> shapes;
+	std::vector<Vector2> points;
+	std::vector<Node> nodes;
+	// Shape indices, grouped by leaf
+	std::vector<int> order;
+	// Per shape bounds, only needed while building
+	std::vector<double> boxes;
+	bool dirty;
+
+	int buildNode(int first, int count);
+	// Signed distance from p to the shape surface (negative inside a polygon) and the outward normal there
+	double distance(const Shape& s, Vector2 p, Vector2& normal);
+	// Fraction of the move d at which a ball of radius r at p first touches the shape, INFINITY if never
+	double impact(const Shape& s, Vector2 p, Vector2 d, double r, Vector2& normal);
+	// Calls f(shape index) for every shape whose bounds overlap the box
+	template <class F>
+	void query(double minX, double minY, double maxX, double maxY, F f);
+};
+
+// Loads obstacles and optional world settings from a scene file into world.
+// Prints the offending line and returns false on errors.
+//
+// One directive per line, in world units with y up; blank lines and lines
+// starting with # are skipped. Shapes use the most recent restitution.
+//   size <width> <height>                     world size, defaults to the window
+//   radius <min> <max>                        radius range of spawned balls
+//   restitution <fraction>                    normal speed kept after a bounce
+//   segment <x1> <y1> <x2> <y2>
+//   polygon <x1> <y1> <x2> <y2> <x3> <y3> ... convex, either winding
+//   peg <x> <y> <radius>
+//   pegs <x> <y> <cols> <rows> <dx> <dy> <radius>
+//                                             grid from the top left, odd rows shifted by dx/2
+bool loadScene(const std::string& path, World& world);
+
+#endif // OBSTACLES_H
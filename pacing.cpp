@@ -0,0 +1,111 @@
+#include <GL/freeglut.h>
+#include <GL/glx.h>
+#include <algorithm>
+
+#include "pacing.h"
+
+// Weight of the newest frame in the moving averages
+const double SMOOTHING = 0.1;
+// Most frames skipped between draws when overloaded
+const int MAX_RENDER_EVERY = 8;
+// With vsync, wake this much early and leave the last stretch to the swap, so
+// a late timer doesn't miss the refresh and wait a whole extra one
+const double VSYNC_SLACK = 0.002;
+
+// Timers can't carry a pointer, so the pacer that scheduled them is kept here
+static FramePacer* scheduled = NULL;
+
+FramePacer::FramePacer(double targetFps, double idleFps)
+	: targetFps(targetFps), idleFps(idleFps), vsync(false), renderEvery(1), frame(0), generation(0),
+	simAverage(0), renderAverage(0), lastSim(0), lastRender(0), rendering(true) {
+	this->frameStart = this->prevStart = this->simEnd = Clock::now();
+}
+
+bool FramePacer::enableVsync() {
+	typedef int (*SwapIntervalMESA)(unsigned);
+	typedef int (*SwapIntervalSGI)(int);
+	typedef void (*SwapIntervalEXT)(Display*, GLXDrawable, int);
+
+	SwapIntervalEXT ext = (SwapIntervalEXT)glXGetProcAddress((const GLubyte*)"glXSwapIntervalEXT");
+	Display* display = glXGetCurrentDisplay();
+	GLXDrawable drawable = glXGetCurrentDrawable();
+	if (ext && display && drawable) {
+		ext(display, drawable, 1);
+		return this->vsync = true;
+	}
+	SwapIntervalMESA mesa = (SwapIntervalMESA)glXGetProcAddress((const GLubyte*)"glXSwapIntervalMESA");
+	if (mesa && mesa(1) == 0)
+		return this->vsync = true;
+	SwapIntervalSGI sgi = (SwapIntervalSGI)glXGetProcAddress((const GLubyte*)"glXSwapIntervalSGI");
+	if (sgi && sgi(1) == 0)
+		return this->vsync = true;
+	return this->vsync = false;
+}
+
+double FramePacer::beginFrame() {
+	this->prevStart = this->frameStart;
+	this->frameStart = Clock::now();
+	this->frame++;
+	this->rendering = this->frame % this->renderEvery == 0;
+	return std::chrono::duration<double>(this->frameStart - this->prevStart).count();
+}
+
+bool FramePacer::shouldRender() {
+	return this->rendering;
+}
+
+void FramePacer::simulated() {
+	this->simEnd = Clock::now();
+	double sim = std::chrono::duration<double>(this->simEnd - this->frameStart).count();
+	this->lastSim = sim;
+	this->simAverage += SMOOTHING * (sim - this->simAverage);
+}
+
+void FramePacer::endFrame(bool idle) {
+	Clock::time_point end = Clock::now();
+	this->lastRender = 0;
+	if (this->rendering) {
+		double render = std::chrono::duration<double>(end - this->simEnd).count();
+		this->lastRender = render;
+		this->renderAverage += SMOOTHING * (render - this->renderAverage);
+	}
+
+	// Shed drawing before simulation: spread the cost of a draw over enough
+	// frames that simulation plus amortised drawing fits the budget
+	if (this->targetFps > 0) {
+		double budget = 1 / this->targetFps;
+		double cost = this->simAverage + this->renderAverage / this->renderEvery;
+		if (cost > budget && this->renderEvery < MAX_RENDER_EVERY)
+			this->renderEvery++;
+		else if (this->renderEvery > 1 && this->simAverage + this->renderAverage / (this->renderEvery - 1) < 0.8 * budget)
+			this->renderEvery--;
+	}
+	if (idle)
+		this->renderEvery = 1;
+
+	double fps = idle ? this->idleFps : this->targetFps;
+	double delay = 0;
+	if (fps > 0) {
+		// Count from the start of this frame so work time is part of the interval.
+		// The swap of a drawn frame already waited for the display, so with
+		// vsync only the rest of the interval is left to the timer.
+		double elapsed = std::chrono::duration<double>(end - this->frameStart).count();
+		delay = 1 / fps - elapsed;
+		if (this->vsync && !idle)
+			delay -= VSYNC_SLACK;
+		delay = std::max(0.0, delay);
+	}
+
+	// Anything scheduled earlier is stale now
+	scheduled = this;
+	glutTimerFunc((unsigned)(delay * 1000), FramePacer::onTimer, ++this->generation);
+}
+
+double FramePacer::workTime() {
+	return this->lastSim + this->lastRender;
+}
+
+void FramePacer::onTimer(int generation) {
+	if (scheduled && generation == scheduled->generation)
+		glutPostRedisplay();
+}
@@ -0,0 +1,53 @@
+#if !defined(PACING_H)
+#define PACING_H
+
+#include <chrono>
+
+// Decides when the next frame runs and whether it gets drawn. Instead of
+// posting a redisplay as soon as a frame ends, the next frame is scheduled
+// with a GLUT timer at the target rate, or at a low tick rate while nothing
+// is moving. If frames take longer than the budget, drawing is skipped on
+// some frames so the simulation keeps real time.
+class FramePacer {
+public:
+	// Frames per second while active, 0 for no cap
+	double targetFps;
+	// Frames per second while idle
+	double idleFps;
+	// Swap interval was set, so glutSwapBuffers already waits for the display
+	bool vsync;
+
+	FramePacer(double targetFps = 60, double idleFps = 4);
+
+	// Ask the driver to sync buffer swaps to the display. Needs a current GL context.
+	bool enableVsync();
+	// Call at the start of display(). Returns the real seconds since the last frame.
+	double beginFrame();
+	// Whether this frame should be drawn
+	bool shouldRender();
+	// Call after simulating, before drawing
+	void simulated();
+	// Call at the end of display() to schedule the next frame
+	void endFrame(bool idle);
+	// Seconds spent simulating and drawing the last finished frame
+	double workTime();
+
+	// Frames simulated per frame drawn, reported in the stats
+	int renderEvery;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::time_point frameStart, prevStart, simEnd;
+	long frame;
+	int generation;
+	// Smoothed seconds of work per frame
+	double simAverage, renderAverage;
+	// Unsmoothed work of the last frame, render is 0 if it wasn't drawn
+	double lastSim, lastRender;
+	bool rendering;
+
+	static void onTimer(int generation);
+};
+
+#endif // PACING_H
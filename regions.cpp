@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <cmath>
+
+#include "regions.h"
+
+// Frames a frozen region stays awake after a ball enters or hits it
+const int WAKE_FRAMES = 60;
+
+RegionMap::RegionMap(double regionSize, int reducedEvery)
+	: regionSize(regionSize), reducedEvery(reducedEvery), activeRegions(0), reducedRegions(0), frozenRegions(0),
+	cols(0), rows(0), width(0), height(0), frame(0), maxRadius(0), cellSize(1), gridX(0), gridY(0), cellCols(1), cellRows(1) {}
+
+// Re-bucket every ball. Needed when balls are added or removed, the world changes size
+// or another engine has moved them.
+void RegionMap::rebuild(World& world) {
+	std::vector<BouncyBall>& balls = world.balls;
+	int c = std::max(1, (int)ceil(world.width / this->regionSize));
+	int r = std::max(1, (int)ceil(world.height / this->regionSize));
+	if (c != this->cols || r != this->rows) {
+		this->cols = c;
+		this->rows = r;
+		this->state.assign(c * r, FROZEN);
+		this->wake.assign(c * r, 0);
+		this->nearMoving.assign(c * r, false);
+	}
+
+	size_t first = balls.size() >= this->ballRegion.size() ? this->ballRegion.size() : 0;
+	if (first == 0)
+		this->members.assign(c * r, std::vector<int>());
+	this->ballRegion.resize(balls.size());
+	this->stepDt.resize(balls.size(), 0);
+	this->cellNext.resize(balls.size(), -1);
+	if (first == 0)
+		this->maxRadius = 0;
+	for (size_t i = first; i < balls.size(); i++) {
+		this->ballRegion[i] = this->regionOf(balls[i].pos);
+		this->members[this->ballRegion[i]].push_back(i);
+		this->maxRadius = std::max(this->maxRadius, balls[i].radius);
+	}
+	this->width = world.width;
+	this->height = world.height;
+}
+
+void RegionMap::invalidate() {
+	this->ballRegion.clear();
+}
+
+void RegionMap::ballsIn(World& world, const ViewRect& view, std::vector<int>& out) {
+	if (world.balls.size() != this->ballRegion.size() || world.width != this->width || world.height != this->height)
+		this->rebuild(world);
+
+	// Balls are bucketed by center, so reach out by the largest radius
+	int x0 = (int)clamp(floor((view.left - this->maxRadius) / this->regionSize), 0, this->cols - 1);
+	int x1 = (int)clamp(floor((view.right + this->maxRadius) / this->regionSize), 0, this->cols - 1);
+	int y0 = (int)clamp(floor((view.bottom - this->maxRadius) / this->regionSize), 0, this->rows - 1);
+	int y1 = (int)clamp(floor((view.top + this->maxRadius) / this->regionSize), 0, this->rows - 1);
+	for (int y = y0; y <= y1; y++) {
+		for (int x = x0; x <= x1; x++) {
+			std::vector<int>& m = this->members[y * this->cols + x];
+			out.insert(out.end(), m.begin(), m.end());
+		}
+	}
+}
+
+int RegionMap::regionOf(const Vector2& pos) {
+	int x = (int)clamp(floor(pos.x / this->regionSize), 0, this->cols - 1);
+	int y = (int)clamp(floor(pos.y / this->regionSize), 0, this->rows - 1);
+	return y * this->cols + x;
+}
+
+// Only regions near the view can wake others. Otherwise every woken region
+// would wake its neighbours in turn and the whole world would end up awake.
+void RegionMap::wakeRegion(int region, int from) {
+	if (this->state[region] == FROZEN && this->state[from] >= REDUCED)
+		this->wake[region] = WAKE_FRAMES;
+}
+
+void RegionMap::updateStates(const ViewRect& view) {
+	int x0 = (int)clamp(floor(view.left / this->regionSize), 0, this->cols - 1);
+	int x1 = (int)clamp(floor(view.right / this->regionSize), 0, this->cols - 1);
+	int y0 = (int)clamp(floor(view.bottom / this->regionSize), 0, this->rows - 1);
+	int y1 = (int)clamp(floor(view.top / this->regionSize), 0, this->rows - 1);
+
+	this->activeRegions = this->reducedRegions = this->frozenRegions = 0;
+	for (int y = 0; y < this->rows; y++) {
+		for (int x = 0; x < this->cols; x++) {
+			int r = y * this->cols + x;
+			if (this->wake[r] > 0)
+				this->wake[r]--;
+
+			if (x >= x0 && x <= x1 && y >= y0 && y <= y1) {
+				this->state[r] = ACTIVE;
+				this->activeRegions++;
+			} else if (x >= x0 - 1 && x <= x1 + 1 && y >= y0 - 1 && y <= y1 + 1) {
+				this->state[r] = REDUCED;
+				this->reducedRegions++;
+			} else if (this->wake[r] > 0) {
+				this->state[r] = WOKEN;
+				this->reducedRegions++;
+			} else {
+				this->state[r] = FROZEN;
+				this->frozenRegions++;
+			}
+		}
+	}
+}
+
+// Balls in regions that move this frame, plus everything around them so
+// moving balls still hit frozen ones. The grid only spans those regions.
+void RegionMap::buildGrid(World& world, const std::vector<int>& movingRegions, double maxReach) {
+	std::vector<BouncyBall>& balls = world.balls;
+
+	// Only reset the cells used last frame, before the layout changes
+	for (int cell : this->usedCells) {
+		this->cellHead[cell] = -1;
+	}
+	this->usedCells.clear();
+
+	std::vector<int> gridRegions;
+	int x0 = this->cols, y0 = this->rows, x1 = -1, y1 = -1;
+	for (int region : movingRegions) {
+		int rx = region % this->cols, ry = region / this->cols;
+		for (int y = std::max(0, ry - 1); y <= std::min(this->rows - 1, ry + 1); y++) {
+			for (int x = std::max(0, rx - 1); x <= std::min(this->cols - 1, rx + 1); x++) {
+				int n = y * this->cols + x;
+				if (!this->nearMoving[n]) {
+					this->nearMoving[n] = true;
+					gridRegions.push_back(n);
+					x0 = std::min(x0, x);
+					y0 = std::min(y0, y);
+					x1 = std::max(x1, x);
+					y1 = std::max(y1, y);
+				}
+			}
+		}
+	}
+	if (gridRegions.empty())
+		return;
+
+	// Rounded up to a power of two so the layout only changes when the
+	// fastest ball crosses a doubling, not every frame
+	double size = 1;
+	while (size < maxReach) {
+		size *= 2;
+	}
+	this->cellSize = size;
+	this->gridX = x0 * this->regionSize;
+	this->gridY = y0 * this->regionSize;
+	this->cellCols = std::max(1, (int)ceil((x1 - x0 + 1) * this->regionSize / size));
+	this->cellRows = std::max(1, (int)ceil((y1 - y0 + 1) * this->regionSize / size));
+	// Every cell is already -1, so growing is the only time this touches memory
+	if (this->cellHead.size() < (size_t)(this->cellCols * this->cellRows))
+		this->cellHead.resize(this->cellCols * this->cellRows, -1);
+
+	for (int region : gridRegions) {
+		this->nearMoving[region] = false;
+		for (int i : this->members[region]) {
+			int cell = this->cellOf(balls[i].pos);
+			if (this->cellHead[cell] < 0)
+				this->usedCells.push_back(cell);
+			this->cellNext[i] = this->cellHead[cell];
+			this->cellHead[cell] = i;
+		}
+	}
+}
+
+int RegionMap::cellOf(const Vector2& pos) {
+	int cx = (int)clamp(floor((pos.x - this->gridX) / this->cellSize), 0, this->cellCols - 1);
+	int cy = (int)clamp(floor((pos.y - this->gridY) / this->cellSize), 0, this->cellRows - 1);
+	return cy * this->cellCols + cx;
+}
+
+// Ball i against everything in the neighbouring cells
+int RegionMap::collide(World& world, int i) {
+	std::vector<BouncyBall>& balls = world.balls;
+	int cell = this->cellOf(balls[i].pos);
+	int cx = cell % this->cellCols, cy = cell / this->cellCols;
+	int hits = 0;
+
+	for (int y = std::max(0, cy - 1); y <= std::min(this->cellRows - 1, cy + 1); y++) {
+		for (int x = std::max(0, cx - 1); x <= std::min(this->cellCols - 1, cx + 1); x++) {
+			for (int j = this->cellHead[y * this->cellCols + x]; j >= 0; j = this->cellNext[j]) {
+				// Moving pairs once, from the lower index
+				if (j == i || (this->stepDt[j] > 0 && j < i))
+					continue;
+				double dt = std::max(this->stepDt[i], this->stepDt[j]);
+				if (isColliding(balls[i], balls[j], dt)) {
+					handleCollision(balls[i], balls[j], dt, world.config.elasticity);
+					// Something hit a frozen ball, so let it move
+					if (this->stepDt[j] == 0)
+						this->wakeRegion(this->ballRegion[j], this->ballRegion[i]);
+					hits++;
+				}
+			}
+		}
+	}
+	return hits;
+}
+
+int RegionMap::step(World& world, double dt, int precision, const ViewRect& view) {
+	std::vector<BouncyBall>& balls = world.balls;
+	if (balls.size() != this->ballRegion.size() || world.width != this->width || world.height != this->height)
+		this->rebuild(world);
+	this->updateStates(view);
+	this->frame++;
+	bool reducedFrame = this->frame % this->reducedEvery == 0;
+
+	// Only the regions that move this frame are visited, so frozen balls cost nothing
+	std::vector<int> movingRegions;
+	std::vector<int> moving;
+	double maxReach = 0;
+	for (size_t r = 0; r < this->state.size(); r++) {
+		double regionDt = 0;
+		if (this->state[r] == ACTIVE)
+			regionDt = dt;
+		else if ((this->state[r] == REDUCED || this->state[r] == WOKEN) && reducedFrame)
+			regionDt = dt * this->reducedEvery;
+		if (regionDt == 0)
+			continue;
+
+		movingRegions.push_back(r);
+		for (int i : this->members[r]) {
+			this->stepDt[i] = regionDt;
+			moving.push_back(i);
+			// Cells must fit two balls plus how far both can move in a step
+			maxReach = std::max(maxReach, 2 * (balls[i].radius + balls[i].vel.mag() * regionDt));
+		}
+	}
+	this->buildGrid(world, movingRegions, maxReach);
+
+	int hits = 0;
+	// In reality this is peformed with infinite precision, but we make do with what we have
+	for (int p = 0; p < precision; p++) {
+		for (int i : moving) {
+			hits += this->collide(world, i);
+		}
+	}
+
+	for (int i : moving) {
+		Vector2 move;
+		bool swept;
+		hits += world.obstacles.collide(balls[i], this->stepDt[i], move, swept);
+		balls[i].update(this->stepDt[i], world.width, world.height, world.config, swept ? &move : NULL);
+		this->stepDt[i] = 0;
+
+		// Moving into another region, which wakes it if it was frozen
+		int region = this->regionOf(balls[i].pos);
+		if (region != this->ballRegion[i]) {
+			std::vector<int>& from = this->members[this->ballRegion[i]];
+			*std::find(from.begin(), from.end(), i) = from.back();
+			from.pop_back();
+			this->members[region].push_back(i);
+			this->wakeRegion(region, this->ballRegion[i]);
+			this->ballRegion[i] = region;
+		}
+	}
+	return hits;
+}
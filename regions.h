@@ -0,0 +1,70 @@
+#if !defined(REGIONS_H)
+#define REGIONS_H
+
+#include <vector>
+
+#include "camera.h"
+#include "world.h"
+
+// Splits a large world into square regions and only pays full price for the
+// ones near the camera. Regions overlapping the view are stepped every frame,
+// their neighbours (and regions a ball from those has just entered or hit)
+// every few frames with a longer step, and everything else is frozen in place. Contacts
+// use a uniform grid instead of the all-pairs loop in World::checkCollisions.
+class RegionMap {
+public:
+	// World units per region side
+	double regionSize;
+	// Neighbouring regions step once per this many frames
+	int reducedEvery;
+	// Region counts from the last step, for reporting
+	int activeRegions, reducedRegions, frozenRegions;
+
+	RegionMap(double regionSize = 1024, int reducedEvery = 4);
+
+	// Steps the balls near view. Returns the number of colliding pairs handled.
+	int step(World& world, double dt, int precision, const ViewRect& view);
+	// Appends the indices of balls in the regions overlapping view, for drawing
+	// without scanning the whole world. May include balls just outside it.
+	void ballsIn(World& world, const ViewRect& view, std::vector<int>& out);
+	// Balls were moved by something other than step, so re-bucket them all next time
+	void invalidate();
+
+private:
+	// WOKEN steps like REDUCED but, being away from the view, can't wake others
+	enum State { FROZEN, WOKEN, REDUCED, ACTIVE };
+
+	int cols, rows;
+	// World size the buckets were built for
+	int width, height;
+	std::vector<unsigned char> state;
+	// Frames a region stays awake after something touched it
+	std::vector<int> wake;
+	long frame;
+
+	// Balls in each region, kept up to date as balls move so frozen ones are never visited
+	std::vector<std::vector<int>> members;
+	std::vector<int> ballRegion;
+	double maxRadius;
+	// Per ball time step this frame, 0 if not moving
+	std::vector<double> stepDt;
+	// Scratch flags for collecting the regions around the moving ones
+	std::vector<bool> nearMoving;
+
+	// Contact grid as linked lists through cellNext, covering only the regions
+	// around the moving ones, with its lower left corner at gridX, gridY
+	double cellSize;
+	double gridX, gridY;
+	int cellCols, cellRows;
+	std::vector<int> cellHead, cellNext, usedCells;
+
+	void rebuild(World& world);
+	int regionOf(const Vector2& pos);
+	void updateStates(const ViewRect& view);
+	void buildGrid(World& world, const std::vector<int>& movingRegions, double maxReach);
+	int cellOf(const Vector2& pos);
+	int collide(World& world, int i);
+	void wakeRegion(int region, int from);
+};
+
+#endif // REGIONS_H
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+FrameStats::FrameStats()
+	: count(0), next(0) {}
+
+void FrameStats::record(double workTime, double interval, int collisions) {
+	this->frameTimes[this->next] = workTime;
+	this->intervals[this->next] = interval;
+	this->collisions[this->next] = collisions;
+	this->next = (this->next + 1) % WINDOW;
+	if (this->count < WINDOW)
+		this->count++;
+}
+
+void FrameStats::fill(StatsSnapshot& s) {
+	s.stepRate = s.frameP50 = s.frameP95 = s.frameP99 = s.frameMax = s.collisionsPerSec = 0;
+	if (this->count == 0)
+		return;
+
+	double sorted[WINDOW];
+	double total = 0;
+	long hits = 0;
+	for (int i = 0; i < this->count; i++) {
+		sorted[i] = this->frameTimes[i];
+		total += this->intervals[i];
+		hits += this->collisions[i];
+	}
+	std::sort(sorted, sorted + this->count);
+
+	s.frameP50 = sorted[(this->count - 1) * 50 / 100];
+	s.frameP95 = sorted[(this->count - 1) * 95 / 100];
+	s.frameP99 = sorted[(this->count - 1) * 99 / 100];
+	s.frameMax = sorted[this->count - 1];
+	if (total > 0) {
+		s.stepRate = this->count / total;
+		s.collisionsPerSec = hits / total;
+	}
+}
+
+StatsServer::StatsServer()
+	: listenFd(-1), middle(1), back(0), front(2), head(0), tail(0) {
+	memset(this->buffers, 0, sizeof(this->buffers));
+}
+
+StatsServer::~StatsServer() {
+	if (!this->path.empty())
+		unlink(this->path.c_str());
+}
+
+bool StatsServer::start(const std::string& path) {
+	sockaddr_un addr;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "stats: socket path too long: " << path << std::endl;
+		return false;
+	}
+
+	this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (this->listenFd < 0) {
+		perror("stats: socket");
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	// Stale socket from a previous run
+	unlink(path.c_str());
+
+	if (bind(this->listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(this->listenFd, 4) < 0) {
+		perror("stats: bind");
+		close(this->listenFd);
+		this->listenFd = -1;
+		return false;
+	}
+	this->path = path;
+
+	std::thread(&StatsServer::run, this).detach();
+	return true;
+}
+
+void StatsServer::publish(const StatsSnapshot& s) {
+	this->buffers[this->back] = s;
+	this->back = this->middle.exchange(this->back | DIRTY, std::memory_order_acq_rel) & 3;
+}
+
+const StatsSnapshot& StatsServer::latest() {
+	if (this->middle.load(std::memory_order_relaxed) & DIRTY)
+		this->front = this->middle.exchange(this->front, std::memory_order_acq_rel) & 3;
+	return this->buffers[this->front];
+}
+
+bool StatsServer::pushCommand(const StatsCommand& cmd) {
+	unsigned t = this->tail.load(std::memory_order_relaxed);
+	if (t - this->head.load(std::memory_order_acquire) == RING_SIZE)
+		return false;
+	this->ring[t % RING_SIZE] = cmd;
+	this->tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+bool StatsServer::pollCommand(StatsCommand& cmd) {
+	unsigned h = this->head.load(std::memory_order_relaxed);
+	if (h == this->tail.load(std::memory_order_acquire))
+		return false;
+	cmd = this->ring[h % RING_SIZE];
+	this->head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+std::string StatsServer::handle(const std::string& line) {
+	std::istringstream in(line);
+	std::string cmd;
+	in >> cmd;
+
+	if (cmd == "stats" || cmd.empty())
+		return statsText(this->latest(), residentMemory());
+	if (cmd == "json")
+		return statsJson(this->latest(), residentMemory());
+
+	StatsCommand c = { StatsCommand::KEY, 0, 0 };
+	if (cmd == "pause" || cmd == "resume") {
+		// Sets rather than toggles, so repeating a command is harmless
+		c.type = StatsCommand::SET_PAUSED;
+		c.value = cmd == "pause";
+	} else if (cmd == "gravity") {
+		c.key = 'x';
+	} else if (cmd == "resistance") {
+		if (!(in >> c.value))
+			return "error: usage: resistance <0..1>\n";
+		c.type = StatsCommand::SET_RESISTANCE;
+	} else if (cmd == "help") {
+		return "commands: stats, json, pause, resume, gravity, resistance <0..1>, help\n";
+	} else {
+		return "error: unknown command '" + cmd + "'\n";
+	}
+
+	if (!this->pushCommand(c))
+		return "error: command queue full\n";
+	return "ok\n";
+}
+
+void StatsServer::run() {
+	std::vector<pollfd> fds = { { this->listenFd, POLLIN, 0 } };
+	std::vector<std::string> pending = { "" };
+
+	while (true) {
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			// Anything else won't go away by retrying, so stop serving rather than spin
+			perror("stats: poll");
+			for (pollfd& p : fds) {
+				close(p.fd);
+			}
+			this->listenFd = -1;
+			return;
+		}
+
+		// New client
+		if (fds[0].revents & POLLIN) {
+			int fd = accept(this->listenFd, NULL, NULL);
+			if (fd >= 0) {
+				fds.push_back({ fd, POLLIN, 0 });
+				pending.push_back("");
+			}
+		}
+
+		for (size_t i = fds.size() - 1; i > 0; i--) {
+			if (!fds[i].revents)
+				continue;
+
+			char buf[256];
+			ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+			if (n > 0) {
+				pending[i].append(buf, n);
+				size_t eol;
+				while ((eol = pending[i].find('\n')) != std::string::npos) {
+					std::string line = pending[i].substr(0, eol);
+					pending[i].erase(0, eol + 1);
+					if (!line.empty() && line.back() == '\r')
+						line.pop_back();
+					std::string reply = this->handle(line);
+					// MSG_NOSIGNAL so a client hanging up can't SIGPIPE the simulation
+					if (send(fds[i].fd, reply.data(), reply.size(), MSG_NOSIGNAL) < 0)
+						break;
+				}
+				// Clients that never send a newline don't get to grow the buffer forever
+				if (pending[i].size() <= 1024)
+					continue;
+			}
+
+			close(fds[i].fd);
+			fds.erase(fds.begin() + i);
+			pending.erase(pending.begin() + i);
+		}
+	}
+}
+
+std::string statsText(const StatsSnapshot& s, size_t rss) {
+	std::ostringstream out;
+	out << "balls: " << s.balls << "\n"
+		<< "paused: " << (s.paused ? "yes" : "no") << "\n"
+		<< "uptime: " << s.uptime << " s\n"
+		<< "step_rate: " << s.stepRate << " /s\n"
+		<< "frame_ms: p50 " << s.frameP50 * 1000 << ", p95 " << s.frameP95 * 1000
+		<< ", p99 " << s.frameP99 * 1000 << ", max " << s.frameMax * 1000 << "\n"
+		<< "collisions_per_sec: " << s.collisionsPerSec << " (over " << s.collisionPasses << " passes per step)\n"
+		<< "render_every: " << s.renderEvery << "\n"
+		<< "kinetic_energy: " << s.kineticEnergy << "\n"
+		<< "momentum: " << s.momentumX << " " << s.momentumY << "\n"
+		<< "resistance: " << s.resistance << "\n"
+		<< "ball_bytes: " << s.ballBytes << "\n"
+		<< "rss_bytes: " << rss << "\n";
+	return out.str();
+}
+
+std::string statsJson(const StatsSnapshot& s, size_t rss) {
+	std::ostringstream out;
+	out << "{\"balls\":" << s.balls
+		<< ",\"paused\":" << (s.paused ? "true" : "false")
+		<< ",\"uptime\":" << s.uptime
+		<< ",\"step_rate\":" << s.stepRate
+		<< ",\"frame_ms\":{\"p50\":" << s.frameP50 * 1000 << ",\"p95\":" << s.frameP95 * 1000
+		<< ",\"p99\":" << s.frameP99 * 1000 << ",\"max\":" << s.frameMax * 1000 << "}"
+		<< ",\"collisions_per_sec\":" << s.collisionsPerSec
+		<< ",\"collision_passes\":" << s.collisionPasses
+		<< ",\"render_every\":" << s.renderEvery
+		<< ",\"kinetic_energy\":" << s.kineticEnergy
+		<< ",\"momentum\":[" << s.momentumX << "," << s.momentumY << "]"
+		<< ",\"resistance\":" << s.resistance
+		<< ",\"ball_bytes\":" << s.ballBytes
+		<< ",\"rss_bytes\":" << rss << "}\n";
+	return out.str();
+}
+
+size_t residentMemory() {
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+	long size, resident;
+	int got = fscanf(f, "%ld %ld", &size, &resident);
+	fclose(f);
+	if (got != 2)
+		return 0;
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+}
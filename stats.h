@@ -0,0 +1,104 @@
+#if !defined(STATS_H)
+#define STATS_H
+
+#include <atomic>
+#include <string>
+#include <cstddef>
+
+// Plain copy of the simulation state the stats server reports
+struct StatsSnapshot {
+	size_t balls;
+	size_t ballBytes;
+	double uptime;
+	double stepRate;
+	// Seconds of work per frame (simulation plus drawing), not counting the
+	// wait for the next frame
+	double frameP50, frameP95, frameP99, frameMax;
+	// Contacts resolved per second, summed over every collision pass of a
+	// step: a pair still touching on the next pass counts again. Divide by
+	// collisionPasses for a rough count of distinct pairs.
+	double collisionsPerSec;
+	// Collision precision passes per step, 1 for the event-driven gas
+	int collisionPasses;
+	// Frames simulated per frame drawn, above 1 when drawing is being shed
+	int renderEvery;
+	double kineticEnergy;
+	double momentumX, momentumY;
+	double resistance;
+	bool paused;
+};
+
+// Rolling window of frame times, intervals and collision counts
+class FrameStats {
+public:
+	FrameStats();
+	// workTime feeds the percentiles, interval (real time since the previous
+	// frame) the step and collision rates
+	void record(double workTime, double interval, int collisions);
+	// Fill in step rate, percentiles and collisions/sec
+	void fill(StatsSnapshot& s);
+
+private:
+	static const int WINDOW = 240;
+	double frameTimes[WINDOW];
+	double intervals[WINDOW];
+	int collisions[WINDOW];
+	int count;
+	int next;
+};
+
+// Control command sent from a stats client to the display loop
+struct StatsCommand {
+	enum Type { KEY, SET_RESISTANCE, SET_PAUSED };
+	Type type;
+	// Key to replay through keyboard() for KEY commands
+	unsigned char key;
+	// New resistance, or 1/0 for SET_PAUSED
+	double value;
+};
+
+// Serves StatsSnapshots over a Unix domain socket from a background thread.
+// The display loop and the server only ever exchange data through a triple
+// buffer and a single-producer command ring, so neither side ever blocks.
+class StatsServer {
+public:
+	StatsServer();
+	// Removes the socket file
+	~StatsServer();
+	// Bind the socket and start the server thread. Returns false on failure.
+	bool start(const std::string& path);
+	// Called by the display loop
+	void publish(const StatsSnapshot& s);
+	// Pops the next pending command, if any. Called by the display loop.
+	bool pollCommand(StatsCommand& cmd);
+
+private:
+	static const int DIRTY = 4;
+	static const unsigned RING_SIZE = 16;
+
+	std::string path;
+	int listenFd;
+
+	// Triple buffer: back is owned by the display loop, front by the server
+	StatsSnapshot buffers[3];
+	std::atomic<int> middle;
+	int back;
+	int front;
+
+	// Commands from the server thread to the display loop
+	StatsCommand ring[RING_SIZE];
+	std::atomic<unsigned> head;
+	std::atomic<unsigned> tail;
+
+	void run();
+	const StatsSnapshot& latest();
+	bool pushCommand(const StatsCommand& cmd);
+	std::string handle(const std::string& line);
+};
+
+std::string statsText(const StatsSnapshot& s, size_t rss);
+std::string statsJson(const StatsSnapshot& s, size_t rss);
+// Resident set size of this process in bytes, 0 if unknown
+size_t residentMemory();
+
+#endif // STATS_H
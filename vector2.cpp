@@ -61,7 +61,11 @@ void Vector2::operator/=(double f) {
 // All are idempotent
 
 double Vector2::distTo(const Vector2& v) {
-	return sqrt(pow(this->x - v.x, 2) + pow(this->y - v.y, 2));
+	// Multiply rather than pow(d, 2): optimized builds do that anyway, and
+	// libm's pow can differ in the last bit, so debug and release would diverge
+	double dx = this->x - v.x;
+	double dy = this->y - v.y;
+	return sqrt(dx * dx + dy * dy);
 }
 
 double Vector2::mag() {
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "world.h"
+
+World::World(int width, int height, PhysicsConfig config)
+	: width(width), height(height), config(config), minRadius(10), maxRadius(39) {}
+
+// Random positions tried per ball before deciding the world is full
+const int MAX_SPAWN_ATTEMPTS = 10000;
+
+int World::spawnBalls(int num, double maxSpeed, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::uniform_int_distribution<int> radius(this->minRadius, this->maxRadius);
+	std::uniform_real_distribution<double> unit(0, 1);
+	std::uniform_real_distribution<double> speed(-maxSpeed, maxSpeed);
+
+	// Overlap checks only look at nearby balls, through a grid of cells as wide
+	// as the largest ball, so spawning is linear rather than quadratic
+	const double cell = 2 * (this->maxRadius + 1);
+	int cols = (int)ceil(this->width / cell) + 1;
+	int rows = (int)ceil(this->height / cell) + 1;
+	std::vector<int> head(cols * rows, -1);
+	std::vector<int> next(this->balls.size() + num, -1);
+	auto cellOf = [&](const Vector2& p, int& x, int& y) {
+		x = (int)clamp(floor(p.x / cell), 0, cols - 1);
+		y = (int)clamp(floor(p.y / cell), 0, rows - 1);
+	};
+	auto insert = [&](int i) {
+		int x, y;
+		cellOf(this->balls[i].pos, x, y);
+		next[i] = head[y * cols + x];
+		head[y * cols + x] = i;
+	};
+	for (size_t i = 0; i < this->balls.size(); i++) {
+		insert(i);
+	}
+
+	for (int i = 0; i < num; i++) {
+		int r = radius(rng);
+		COLOR c = { unit(rng), unit(rng), unit(rng) };
+		BouncyBall b(Vector2(), Vector2(), r, c, this->config.gravity);
+		// Make sure the ball doesn't spawn inside another
+		bool overlaps;
+		int attempts = 0;
+		do {
+			if (++attempts > MAX_SPAWN_ATTEMPTS)
+				return i;
+			b.pos.x = clamp(unit(rng) * this->width, r, this->width - r);
+			b.pos.y = clamp(unit(rng) * this->height, r, this->height - r);
+			b.vel = Vector2(speed(rng), speed(rng));
+
+			overlaps = this->obstacles.overlaps(b);
+			int cx, cy;
+			cellOf(b.pos, cx, cy);
+			for (int y = std::max(0, cy - 1); y <= std::min(rows - 1, cy + 1) && !overlaps; y++) {
+				for (int x = std::max(0, cx - 1); x <= std::min(cols - 1, cx + 1) && !overlaps; x++) {
+					for (int j = head[y * cols + x]; j >= 0 && !overlaps; j = next[j]) {
+						overlaps = isColliding(this->balls[j], b, 0);
+					}
+				}
+			}
+		} while (overlaps);
+		this->balls.push_back(b);
+		insert(this->balls.size() - 1);
+	}
+	return num;
+}
+
+int World::checkCollisions(double dt) {
+	int hits = 0;
+	for (size_t i = 0; i < this->balls.size(); i++) {
+		for (size_t j = i + 1; j < this->balls.size(); j++) {
+			if (isColliding(this->balls[i], this->balls[j], dt)) {
+				handleCollision(this->balls[i], this->balls[j], dt, this->config.elasticity);
+				hits++;
+			}
+		}
+	}
+	return hits;
+}
+
+bool World::anyCollisions(double dt, BouncyBall b) {
+	for (size_t i = 0; i < this->balls.size(); i++) {
+		if (isColliding(this->balls[i], b, dt)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int World::step(double dt, int precision) {
+	int hits = 0;
+	// In reality this is peformed with infinite precision, but we make do with what we have
+	for (int i = 0; i < precision; i++) {
+		hits += this->checkCollisions(dt);
+	}
+	for (auto ball = this->balls.begin(); ball != this->balls.end(); ++ball) {
+		Vector2 move;
+		bool swept;
+		hits += this->obstacles.collide(*ball, dt, move, swept);
+		ball->update(dt, this->width, this->height, this->config, swept ? &move : NULL);
+	}
+	return hits;
+}
+
+double World::kineticEnergy() {
+	double e = 0;
+	for (size_t i = 0; i < this->balls.size(); i++) {
+		BouncyBall& b = this->balls[i];
+		e += 0.5 * b.mass() * (b.vel.x * b.vel.x + b.vel.y * b.vel.y);
+	}
+	return e;
+}
+
+Vector2 World::momentum() {
+	Vector2 p;
+	for (size_t i = 0; i < this->balls.size(); i++) {
+		p += this->balls[i].vel * this->balls[i].mass();
+	}
+	return p;
+}
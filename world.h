@@ -0,0 +1,36 @@
+#if !defined(WORLD_H)
+#define WORLD_H
+
+#include <vector>
+
+#include "bouncyball.h"
+#include "obstacles.h"
+
+// A set of balls in a box with its own physics constants. Holds no GL state,
+// so worlds can be stepped headless and several at once on different threads.
+class World {
+public:
+	std::vector<BouncyBall> balls;
+	int width, height;
+	PhysicsConfig config;
+	// Radius range for spawned balls
+	int minRadius, maxRadius;
+	// Static geometry, empty unless a scene was loaded
+	Obstacles obstacles;
+
+	World(int width, int height, PhysicsConfig config = PhysicsConfig());
+
+	// Scatter num balls, overlapping neither each other nor obstacles, with random radius, color and velocity
+	// Returns how many were placed, fewer than num if they don't fit
+	int spawnBalls(int num, double maxSpeed, unsigned seed);
+	// Resolve every colliding pair once. Returns the number of pairs handled.
+	int checkCollisions(double dt);
+	bool anyCollisions(double dt, BouncyBall b);
+	// precision collision passes, then move every ball. Returns collisions handled.
+	int step(double dt, int precision);
+
+	double kineticEnergy();
+	Vector2 momentum();
+};
+
+#endif // WORLD_H